@@ -0,0 +1,530 @@
+/*
+ * access_log.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "access_log.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+struct access_log::buffer_
+{
+    std::mutex mutex;
+    block_ records;
+    std::unordered_map<std::string, uint32_t> hosts;    // owner thread only
+};
+
+namespace
+{
+    const char magic[8] = {'c', 'u', 'r', 'l', 'a', 'l', 'g', '1'};
+
+    struct segment_header
+    {
+        char magic[8];
+        uint32_t record_size;
+        uint32_t reserved;
+        uint64_t capacity;
+        uint64_t count;         // committed records, updated after each write
+        int64_t created;        // ns since the epoch
+        char padding[24];
+    };
+
+    static_assert(sizeof(segment_header) == sizeof(access_record),
+                  "segment header should take one record slot");
+
+    std::atomic<uint64_t> next_log_id(1);
+
+    int64_t now_ns()
+    {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+    }
+
+    uint32_t micros(easy& handle, CURLINFO info)
+    {
+        curl_off_t us = handle.info<curl_off_t>(info);
+        return us < 0 ? 0 : us > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(us);
+    }
+
+    // host part of a URL without parsing all of it
+    std::string host_of(const std::string& address)
+    {
+        size_t start = address.find("://");
+        start = start == std::string::npos ? 0 : start + 3;
+        size_t end = address.find_first_of("/?#", start);
+        if(end == std::string::npos)
+            end = address.size();
+
+        size_t at = address.rfind('@', end - 1);
+        if(at != std::string::npos && at >= start && end > start)
+            start = at + 1;
+
+        if(start < end && address[start] == '[')
+        {
+            size_t close = address.find(']', start);
+            return address.substr(start, (close < end ? close + 1 : end) - start);
+        }
+        size_t colon = address.find(':', start);
+        return address.substr(start, (colon < end ? colon : end) - start);
+    }
+
+    std::string segment_name(const std::string& directory, unsigned int serial)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/access-%06u.log", serial);
+        return directory + name;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+access_log::access_log(const std::string& directory)
+    : access_log(directory, options())
+{}
+
+access_log::access_log(const std::string& directory, options opts)
+    : directory_(directory)
+    , opts_(opts)
+    , id_(next_log_id++)
+    , hosts_file_(nullptr)
+    , running_(true)
+    , fd_(-1)
+    , map_(nullptr)
+    , serial_(0)
+    , count_(0)
+    , written_(0)
+{
+    opts_.segment_records = std::max<size_t>(opts_.segment_records, 1);
+    opts_.buffer_records = std::max<size_t>(opts_.buffer_records, 1);
+
+    // ids of earlier runs stay valid; new hosts get the next free ones
+    std::string path = directory + "/hosts";
+    if(FILE * in = fopen(path.c_str(), "re"))
+    {
+        char line[4096];
+        while(fgets(line, sizeof(line), in))
+        {
+            char * tab = strchr(line, '\t');
+            if(tab == nullptr)
+                continue;
+            std::string name(tab + 1, strcspn(tab + 1, "\n"));
+            hosts_[name] = strtoul(line, nullptr, 10);
+        }
+        fclose(in);
+    }
+    hosts_file_ = fopen(path.c_str(), "ae");
+    if(hosts_file_ == nullptr)
+        throw ERROR("Failed to open access log host table");
+
+    thread_ = std::thread(&access_log::run_, this);
+}
+
+access_log::~access_log()
+{
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        running_ = false;
+    }
+    wakeup_.notify_one();
+    thread_.join();
+
+    try
+    {
+        drain_(true);
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        close_segment_();
+    }
+    catch(...)
+    {}
+    fclose(hosts_file_);
+}
+
+void access_log::record(easy& handle, CURLcode result)
+{
+    access_record r;
+    memset(&r, 0, sizeof(r));
+    r.time = now_ns();
+
+    // copied at once, the pointer is only valid until the handle changes
+    const char * url = handle.info<const char *>(CURLINFO_EFFECTIVE_URL);
+    std::string address = url ? url : "";
+    if(!address.empty())
+    {
+        // most transfers go to hosts this thread has seen before
+        buffer_& b = local_();
+        std::string host = host_of(address);
+        auto it = b.hosts.find(host);
+        if(it == b.hosts.end())
+            it = b.hosts.emplace(host, host_id(host)).first;
+        r.host = it->second;
+    }
+
+    long status = handle.info<long>(CURLINFO_RESPONSE_CODE);
+    r.status = static_cast<uint16_t>(status);
+    r.result = static_cast<uint16_t>(result);
+    r.bytes_down = handle.info<curl_off_t>(CURLINFO_SIZE_DOWNLOAD_T);
+    r.bytes_up = handle.info<curl_off_t>(CURLINFO_SIZE_UPLOAD_T);
+    r.namelookup = micros(handle, CURLINFO_NAMELOOKUP_TIME_T);
+    r.connect = micros(handle, CURLINFO_CONNECT_TIME_T);
+    r.appconnect = micros(handle, CURLINFO_APPCONNECT_TIME_T);
+    r.pretransfer = micros(handle, CURLINFO_PRETRANSFER_TIME_T);
+    r.starttransfer = micros(handle, CURLINFO_STARTTRANSFER_TIME_T);
+    r.total = micros(handle, CURLINFO_TOTAL_TIME_T);
+    r.http_version = static_cast<uint8_t>(handle.info<long>(CURLINFO_HTTP_VERSION));
+    r.redirects = static_cast<uint16_t>(handle.info<long>(CURLINFO_REDIRECT_COUNT));
+
+    // a transfer that got a response without connecting reused a connection
+    if(status != 0 && handle.info<long>(CURLINFO_NUM_CONNECTS) == 0)
+        r.flags |= access_record::reused_connection;
+
+    record(r);
+}
+
+void access_log::record(const access_record& r)
+{
+    buffer_& b = local_();
+    block_ full;
+    {
+        std::lock_guard<std::mutex> lock(b.mutex);
+        b.records.push_back(r);
+        if(b.records.size() < opts_.buffer_records)
+            return;
+        full.swap(b.records);
+        b.records.reserve(opts_.buffer_records);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        full_.push_back(std::move(full));
+    }
+    wakeup_.notify_one();
+}
+
+uint32_t access_log::host_id(const std::string& host)
+{
+    std::lock_guard<std::mutex> lock(hosts_mutex_);
+    auto it = hosts_.find(host);
+    if(it != hosts_.end())
+        return it->second;
+
+    uint32_t id = static_cast<uint32_t>(hosts_.size());
+    hosts_[host] = id;
+
+    // the table has to be on disk before any record using the id
+    if(fprintf(hosts_file_, "%u\t%s\n", id, host.c_str()) < 0 || fflush(hosts_file_) != 0)
+        throw ERROR("Failed to write access log host table");
+    return id;
+}
+
+void access_log::flush()
+{
+    drain_(true);
+}
+
+access_log::buffer_& access_log::local_()
+{
+    // one buffer per thread and log; entries of destroyed logs are dropped
+    // when the thread starts writing to a new one
+    static thread_local std::vector<std::pair<uint64_t, std::shared_ptr<buffer_>>> mine;
+    for(auto&& e : mine)
+        if(e.first == id_)
+            return *e.second;
+
+    mine.erase(std::remove_if(mine.begin(), mine.end(),
+        [](const std::pair<uint64_t, std::shared_ptr<buffer_>>& e) {
+            return e.second.use_count() == 1;
+        }), mine.end());
+
+    std::shared_ptr<buffer_> b(new buffer_);
+    b->records.reserve(opts_.buffer_records);
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        buffers_.push_back(b);
+    }
+    mine.emplace_back(id_, b);
+    return *b;
+}
+
+void access_log::run_()
+{
+    auto last = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    while(running_)
+    {
+        wakeup_.wait_for(lock, opts_.interval,
+                         [this]{ return !running_ || !full_.empty(); });
+        auto now = std::chrono::steady_clock::now();
+        bool partial = now - last >= opts_.interval;
+        if(partial)
+            last = now;
+
+        lock.unlock();
+        try
+        {
+            drain_(partial);
+        }
+        catch(const error&)
+        {
+            // the records are lost, but logging goes on
+        }
+        lock.lock();
+    }
+}
+
+void access_log::drain_(bool partial)
+{
+    std::lock_guard<std::mutex> write_lock(write_mutex_);
+
+    std::vector<block_> blocks;
+    std::vector<std::shared_ptr<buffer_>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        blocks.swap(full_);
+        if(partial)
+            buffers = buffers_;
+    }
+
+    for(auto&& b : blocks)
+        write_(b);
+
+    for(auto&& b : buffers)
+    {
+        block_ part;
+        {
+            std::lock_guard<std::mutex> lock(b->mutex);
+            part.swap(b->records);
+        }
+        write_(part);
+    }
+
+    if(partial)
+    {
+        // buffers of threads that have exited are only referenced by
+        // `buffers_` and the copy above
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(),
+            [](const std::shared_ptr<buffer_>& b) {
+                return b.use_count() == 2;
+            }), buffers_.end());
+    }
+}
+
+void access_log::write_(const block_& records)
+{
+    size_t i = 0;
+    while(i < records.size())
+    {
+        if(map_ == nullptr || count_ == opts_.segment_records)
+        {
+            close_segment_();
+            open_segment_();
+        }
+
+        size_t len = std::min(records.size() - i, opts_.segment_records - count_);
+        memcpy(map_ + (count_ + 1) * sizeof(access_record), &records[i],
+               len * sizeof(access_record));
+        count_ += len;
+        i += len;
+
+        // readers of the live segment see a consistent prefix
+        segment_header * h = reinterpret_cast<segment_header *>(map_);
+        __atomic_store_n(&h->count, count_, __ATOMIC_RELEASE);
+    }
+    written_ += records.size();
+}
+
+void access_log::open_segment_()
+{
+    std::string path;
+    for(;;)
+    {
+        path = segment_name(directory_, serial_);
+        fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if(fd_ >= 0)
+            break;
+        if(errno != EEXIST)
+            throw ERROR("Failed to create access log segment");
+        ++serial_;
+    }
+
+    size_t size = (opts_.segment_records + 1) * sizeof(access_record);
+    void * map = MAP_FAILED;
+    if(ftruncate(fd_, size) == 0)
+        map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if(map == MAP_FAILED)
+    {
+        close(fd_);
+        fd_ = -1;
+        unlink(path.c_str());
+        throw ERROR("Failed to map access log segment");
+    }
+
+    map_ = static_cast<char *>(map);
+    count_ = 0;
+    segment_header * h = reinterpret_cast<segment_header *>(map_);
+    memcpy(h->magic, magic, sizeof(magic));
+    h->record_size = sizeof(access_record);
+    h->capacity = opts_.segment_records;
+    h->count = 0;
+    h->created = now_ns();
+}
+
+void access_log::close_segment_()
+{
+    if(map_ == nullptr)
+        return;
+
+    // give the unused part of the segment back
+    munmap(map_, (opts_.segment_records + 1) * sizeof(access_record));
+    map_ = nullptr;
+    int rc = ftruncate(fd_, (count_ + 1) * sizeof(access_record));
+    close(fd_);
+    fd_ = -1;
+    ++serial_;
+    if(rc != 0)
+        throw ERROR("Failed to truncate access log segment");
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+access_log_reader::access_log_reader(const std::string& directory)
+{
+    DIR * dir = opendir(directory.c_str());
+    if(dir == nullptr)
+        throw ERROR("Failed to open access log directory");
+    while(struct dirent * e = readdir(dir))
+    {
+        std::string name = e->d_name;
+        if(name.size() > 11 && name.compare(0, 7, "access-") == 0
+           && name.compare(name.size() - 4, 4, ".log") == 0)
+            segments_.push_back(directory + "/" + name);
+    }
+    closedir(dir);
+    std::sort(segments_.begin(), segments_.end());
+
+    std::string path = directory + "/hosts";
+    if(FILE * in = fopen(path.c_str(), "re"))
+    {
+        char line[4096];
+        while(fgets(line, sizeof(line), in))
+        {
+            char * tab = strchr(line, '\t');
+            if(tab)
+                hosts_[strtoul(line, nullptr, 10)] = std::string(tab + 1, strcspn(tab + 1, "\n"));
+        }
+        fclose(in);
+    }
+}
+
+uint64_t access_log_reader::size() const
+{
+    uint64_t total = 0;
+    for_each([&total](const access_record&) { ++total; });
+    return total;
+}
+
+const std::string& access_log_reader::host(uint32_t id) const
+{
+    static const std::string none;
+    auto it = hosts_.find(id);
+    return it == hosts_.end() ? none : it->second;
+}
+
+void access_log_reader::for_each(const std::function<void(const access_record&)>& fn) const
+{
+    for(auto&& path : segments_)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+            throw ERROR("Failed to open access log segment");
+
+        struct stat st;
+        void * map = MAP_FAILED;
+        if(fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(segment_header))
+            map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if(map == MAP_FAILED)
+            throw ERROR("Failed to map access log segment");
+
+        const segment_header * h = static_cast<const segment_header *>(map);
+        if(memcmp(h->magic, magic, sizeof(magic)) != 0 || h->record_size != sizeof(access_record))
+        {
+            munmap(map, st.st_size);
+            throw ERROR("Not an access log segment");
+        }
+
+        // the segment may still be written to
+        uint64_t count = __atomic_load_n(&h->count, __ATOMIC_ACQUIRE);
+        count = std::min<uint64_t>(count, st.st_size / sizeof(access_record) - 1);
+        const access_record * records = reinterpret_cast<const access_record *>(h + 1);
+
+        try
+        {
+            for(uint64_t i = 0; i < count; ++i)
+                fn(records[i]);
+        }
+        catch(...)
+        {
+            munmap(map, st.st_size);
+            throw;
+        }
+        munmap(map, st.st_size);
+    }
+}
+
+void access_log_reader::dump(FILE * out) const
+{
+    fprintf(out, "time\thost\tstatus\tresult\tbytes_down\tbytes_up\tnamelookup_us\t"
+                 "connect_us\tappconnect_us\tpretransfer_us\tstarttransfer_us\t"
+                 "total_us\thttp_version\treused\tredirects\n");
+
+    for_each([this, out](const access_record& r) {
+        time_t secs = r.time / 1000000000;
+        struct tm tm;
+        gmtime_r(&secs, &tm);
+        char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+
+        fprintf(out, "%s.%03uZ\t%s\t%u\t%u\t%llu\t%llu\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\n",
+                when, static_cast<unsigned>(r.time / 1000000 % 1000),
+                host(r.host).c_str(), r.status, r.result,
+                static_cast<unsigned long long>(r.bytes_down),
+                static_cast<unsigned long long>(r.bytes_up),
+                r.namelookup, r.connect, r.appconnect, r.pretransfer,
+                r.starttransfer, r.total, r.http_version,
+                r.flags & access_record::reused_connection ? 1u : 0u, r.redirects);
+    });
+}
+
+}
+
+#undef ERROR
@@ -0,0 +1,181 @@
+/*
+ * access_log.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_ACCESS_LOG_H
+#define CURLPP_ACCESS_LOG_H
+
+#include "curl++.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// one finished transfer; the on-disk record layout
+struct access_record
+{
+    uint64_t time;              // end of the transfer, ns since the epoch
+    uint32_t host;              // id in the log's host table
+    uint16_t status;            // HTTP response code, 0 if there was none
+    uint16_t result;            // CURLcode
+    uint64_t bytes_down;
+    uint64_t bytes_up;
+    uint32_t namelookup;        // phase timings in microseconds
+    uint32_t connect;
+    uint32_t appconnect;
+    uint32_t pretransfer;
+    uint32_t starttransfer;
+    uint32_t total;
+    uint8_t http_version;       // CURL_HTTP_VERSION_*
+    uint8_t flags;              // reused_connection
+    uint16_t redirects;
+    uint32_t reserved;
+
+    enum
+    {
+        reused_connection = 1,
+    };
+};
+
+static_assert(sizeof(access_record) == 64, "access_record layout changed");
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Binary log with one access_record per transfer.
+//
+// `record` appends to a buffer owned by the calling thread, so threads do not
+// contend with each other; full buffers are handed to a background thread,
+// which copies them into memory-mapped segment files
+// (`<directory>/access-000000.log`, ...) of `segment_records` records each.
+// Partially filled buffers are written every `interval`, so records of
+// different threads, and occasionally of one thread, are not strictly in time
+// order. Host names are kept in `<directory>/hosts`, one "id<TAB>name" line
+// per host.
+class access_log
+{
+public:
+    struct options
+    {
+        size_t segment_records = 1 << 20;   // 64 MiB segments
+        size_t buffer_records = 256;
+        std::chrono::milliseconds interval = std::chrono::milliseconds(1000);
+    };
+
+    explicit access_log(const std::string& directory);
+    access_log(const std::string& directory, options opts);
+
+    // writes what is left
+    ~access_log();
+
+    access_log(const access_log& other) = delete;
+    access_log& operator = (const access_log& other) = delete;
+
+    // log the transfer `handle` just finished with `result`
+    void record(easy& handle, CURLcode result);
+    void record(const access_record& r);
+
+    uint32_t host_id(const std::string& host);
+
+    // write all buffered records now
+    void flush();
+
+    inline uint64_t written() const
+    { return written_; }
+
+private:
+    struct buffer_;
+    typedef std::vector<access_record> block_;
+
+    std::string directory_;
+    options opts_;
+    uint64_t id_;               // tells logs apart in thread-local storage
+
+    // host table
+    std::mutex hosts_mutex_;
+    std::unordered_map<std::string, uint32_t> hosts_;
+    FILE * hosts_file_;
+
+    // per-thread buffers and full blocks waiting for the writer
+    std::mutex queue_mutex_;
+    std::condition_variable wakeup_;
+    std::vector<std::shared_ptr<buffer_>> buffers_;
+    std::vector<block_> full_;
+    bool running_;
+
+    // current segment, only touched with `write_mutex_` held
+    std::mutex write_mutex_;
+    int fd_;
+    char * map_;
+    unsigned int serial_;
+    uint64_t count_;
+    std::atomic<uint64_t> written_;
+
+    std::thread thread_;
+
+    buffer_& local_();
+    void run_();
+    void drain_(bool partial);
+    void write_(const block_& records);
+    void open_segment_();
+    void close_segment_();
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// reads the segments of an access log directory
+class access_log_reader
+{
+public:
+    explicit access_log_reader(const std::string& directory);
+
+    // number of records in all segments
+    uint64_t size() const;
+
+    // host name for an id, empty if unknown
+    const std::string& host(uint32_t id) const;
+
+    // every record, oldest segment first
+    void for_each(const std::function<void(const access_record&)>& fn) const;
+
+    // one tab-separated line per record, with a header line
+    void dump(FILE * out) const;
+
+private:
+    std::vector<std::string> segments_;
+    std::map<uint32_t, std::string> hosts_;
+};
+
+}
+
+#endif /* CURLPP_ACCESS_LOG_H */
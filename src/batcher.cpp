@@ -0,0 +1,446 @@
+/*
+ * batcher.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "batcher.h"
+#include <algorithm>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+// one batch request on its way
+struct batcher::flight_
+{
+    std::vector<call_> calls;
+    std::vector<std::string> payloads;
+    std::string body;
+    list headers;
+    std::string response;
+    pool::lease handle;
+};
+
+namespace
+{
+    size_t append(char * data, size_t size, size_t nmemb, void * arg)
+    {
+        static_cast<std::string *>(arg)->append(data, size * nmemb);
+        return size * nmemb;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+batcher::batcher(pool& handles, std::string address, options opts,
+                 encoder enc, decoder dec)
+    : handles_(handles)
+    , address_(std::move(address))
+    , opts_(std::move(opts))
+    , encode_(std::move(enc))
+    , decode_(std::move(dec))
+    , flush_(false)
+    , running_(true)
+{
+    opts_.max_in_flight = std::max<size_t>(opts_.max_in_flight, 1);
+    queue_.reserve(opts_.max_items);
+    thread_ = std::thread(&batcher::run_, this);
+}
+
+batcher::~batcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    wakeup_.notify_one();
+    multi_.wakeup();
+    thread_.join();
+}
+
+std::future<std::string> batcher::call(std::string payload)
+{
+    std::future<std::string> result;
+    bool notify;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(queue_.empty())
+            oldest_ = clock::now();
+        queue_.push_back(call_{std::move(payload), std::promise<std::string>()});
+        result = queue_.back().result.get_future();
+
+        // the first call starts the batch's timer, the last one fills it
+        notify = queue_.size() == 1 || queue_.size() % opts_.max_items == 0;
+    }
+
+    if(notify)
+    {
+        // the background thread waits on either, depending on whether
+        // batches are in flight
+        wakeup_.notify_one();
+        multi_.wakeup();
+    }
+    return result;
+}
+
+void batcher::flush()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        flush_ = true;
+    }
+    wakeup_.notify_one();
+    multi_.wakeup();
+}
+
+void batcher::run_()
+{
+    std::vector<call_> batch;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    for(;;)
+    {
+        // start every batch that is due while there is room for it
+        while(!queue_.empty() && flights_.size() < opts_.max_in_flight && due_())
+        {
+            size_t count = std::min(queue_.size(), opts_.max_items);
+            std::move(queue_.begin(), queue_.begin() + count,
+                      std::back_inserter(batch));
+            queue_.erase(queue_.begin(), queue_.begin() + count);
+            if(queue_.empty())
+                flush_ = false;
+            else
+                oldest_ = clock::now();
+
+            lock.unlock();
+            start_(batch);
+            batch.clear();
+            lock.lock();
+        }
+
+        if(flights_.empty())
+        {
+            // on shutdown, everything queued has been sent by now
+            if(!running_)
+                break;
+
+            // wait for the batch to fill up or its deadline to pass
+            if(queue_.empty())
+                wakeup_.wait(lock, [this]{ return !queue_.empty() || !running_; });
+            else
+                wakeup_.wait_until(lock, oldest_ + opts_.max_delay, [this]{ return due_(); });
+            continue;
+        }
+
+        // wait for transfers, new calls, or the deadline of the next batch
+        int timeout = 1000;
+        if(!queue_.empty() && flights_.size() < opts_.max_in_flight)
+        {
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                oldest_ + opts_.max_delay - clock::now() + std::chrono::microseconds(999));
+            timeout = static_cast<int>(std::max<long long>(wait.count(), 0));
+        }
+
+        lock.unlock();
+        multi_.poll(timeout);
+        multi_.perform();
+
+        CURL * handle;
+        CURLcode result;
+        while(multi_.next_done(handle, result))
+            finish_(handle, result);
+        lock.lock();
+    }
+}
+
+bool batcher::due_() const
+{
+    return queue_.size() >= opts_.max_items || flush_ || !running_
+        || clock::now() >= oldest_ + opts_.max_delay;
+}
+
+void batcher::start_(std::vector<call_>& batch)
+{
+    std::unique_ptr<flight_> f;
+    try
+    {
+        pool::lease handle = handles_.acquire(address_);
+        std::vector<std::string> payloads;
+        payloads.reserve(batch.size());
+        for(auto&& c : batch)
+            payloads.push_back(std::move(c.payload));
+        std::string body = encode_(payloads);
+
+        f.reset(new flight_{std::move(batch), std::move(payloads), std::move(body),
+                            list(), std::string(), std::move(handle)});
+
+        f->headers += "Content-Type: " + opts_.content_type;
+        f->handle->set(CURLOPT_HTTPHEADER, *f->headers);
+        f->handle->set(CURLOPT_POSTFIELDSIZE, static_cast<long>(f->body.size()));
+        f->handle->set(CURLOPT_POSTFIELDS, f->body.c_str());
+        f->handle->set(CURLOPT_NOSIGNAL, 1L);
+        f->handle->set(CURLOPT_WRITEFUNCTION, append);
+        f->handle->set(CURLOPT_WRITEDATA, static_cast<void *>(&f->response));
+
+        CURL * curl = f->handle->handle();
+        multi_.add(curl);
+        flights_[curl] = std::move(f);
+    }
+    catch(...)
+    {
+        fail_(f ? f->calls : batch, std::current_exception());
+    }
+}
+
+void batcher::finish_(CURL * handle, CURLcode result)
+{
+    auto it = flights_.find(handle);
+    if(it == flights_.end())
+        return;
+    std::unique_ptr<flight_> f = std::move(it->second);
+    flights_.erase(it);
+
+    try
+    {
+        multi_.remove(handle);
+        if(result != CURLE_OK)
+            throw error("Batch request failed", result, __FILE__, __LINE__);
+
+        long status = f->handle->info<long>(CURLINFO_RESPONSE_CODE);
+        if(status < 200 || status >= 300)
+            throw ERROR("Batch request failed with HTTP error status");
+
+        std::vector<std::exception_ptr> errors(f->calls.size());
+        std::vector<std::string> results = decode_(f->payloads, f->response, errors);
+        if(results.size() != f->calls.size() || errors.size() != f->calls.size())
+            throw ERROR("Batch response does not match the number of calls");
+
+        for(size_t i = 0; i < f->calls.size(); ++i)
+        {
+            if(errors[i])
+                f->calls[i].result.set_exception(errors[i]);
+            else
+                f->calls[i].result.set_value(std::move(results[i]));
+        }
+    }
+    catch(...)
+    {
+        fail_(f->calls, std::current_exception());
+    }
+}
+
+void batcher::fail_(std::vector<call_>& batch, std::exception_ptr exc)
+{
+    for(auto&& c : batch)
+    {
+        // calls already answered keep their value
+        try
+        {
+            c.result.set_exception(exc);
+        }
+        catch(const std::future_error&)
+        {}
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+    size_t skip_space(const std::string& s, size_t pos)
+    {
+        while(pos < s.size() && (s[pos] == ' ' || s[pos] == '\t' ||
+                                 s[pos] == '\n' || s[pos] == '\r'))
+            ++pos;
+        return pos;
+    }
+
+    // position just past the JSON value starting at `pos`
+    size_t value_end(const std::string& s, size_t pos)
+    {
+        int depth = 0;
+        bool in_string = false;
+
+        for(; pos < s.size(); ++pos)
+        {
+            char c = s[pos];
+            if(in_string)
+            {
+                if(c == '\\')
+                    ++pos;
+                else if(c == '"')
+                {
+                    in_string = false;
+                    if(depth == 0)
+                        return pos + 1;
+                }
+                continue;
+            }
+
+            switch(c)
+            {
+            case '"':
+                in_string = true;
+                break;
+            case '[': case '{':
+                ++depth;
+                break;
+            case ']': case '}':
+                if(depth == 0)
+                    return pos;         // end of a scalar in a container
+                if(--depth == 0)
+                    return pos + 1;
+                break;
+            case ',': case ' ': case '\t': case '\n': case '\r':
+                if(depth == 0)
+                    return pos;
+                break;
+            }
+        }
+
+        if(depth || in_string)
+            throw ERROR("Malformed JSON in batch response");
+        return pos;
+    }
+
+    std::vector<std::string> split_array(const std::string& s)
+    {
+        std::vector<std::string> items;
+        size_t pos = skip_space(s, 0);
+        if(pos >= s.size() || s[pos] != '[')
+            throw ERROR("Batch response is not a JSON array");
+
+        pos = skip_space(s, pos + 1);
+        if(pos < s.size() && s[pos] == ']')
+            return items;
+
+        for(;;)
+        {
+            size_t end = value_end(s, pos);
+            items.push_back(s.substr(pos, end - pos));
+
+            pos = skip_space(s, end);
+            if(pos >= s.size())
+                throw ERROR("Malformed JSON in batch response");
+            if(s[pos] == ']')
+                return items;
+            if(s[pos] != ',')
+                throw ERROR("Malformed JSON in batch response");
+            pos = skip_space(s, pos + 1);
+        }
+    }
+
+    // raw text of the "id" member of a JSON object, or an empty string
+    std::string member_id(const std::string& s)
+    {
+        size_t pos = skip_space(s, 0);
+        if(pos >= s.size() || s[pos] != '{')
+            return std::string();
+
+        pos = skip_space(s, pos + 1);
+        while(pos < s.size() && s[pos] == '"')
+        {
+            size_t key_end = value_end(s, pos);
+            bool is_id = s.compare(pos, key_end - pos, "\"id\"") == 0;
+
+            pos = skip_space(s, key_end);
+            if(pos >= s.size() || s[pos] != ':')
+                break;
+            pos = skip_space(s, pos + 1);
+
+            size_t end = value_end(s, pos);
+            if(is_id)
+                return s.substr(pos, end - pos);
+
+            pos = skip_space(s, end);
+            if(pos >= s.size() || s[pos] != ',')
+                break;
+            pos = skip_space(s, pos + 1);
+        }
+        return std::string();
+    }
+}
+
+std::string json_array_encode(const std::vector<std::string>& payloads)
+{
+    size_t size = 2;
+    for(auto&& p : payloads)
+        size += p.size() + 1;
+
+    std::string body;
+    body.reserve(size);
+    body.push_back('[');
+    for(auto&& p : payloads)
+    {
+        if(body.size() > 1)
+            body.push_back(',');
+        body.append(p);
+    }
+    body.push_back(']');
+    return body;
+}
+
+std::vector<std::string> json_array_decode(
+    const std::vector<std::string>&, const std::string& body,
+    std::vector<std::exception_ptr>&)
+{
+    return split_array(body);
+}
+
+std::vector<std::string> json_rpc_decode(
+    const std::vector<std::string>& payloads, const std::string& body,
+    std::vector<std::exception_ptr>& errors)
+{
+    std::map<std::string, std::string> by_id;
+    for(auto&& item : split_array(body))
+    {
+        std::string id = member_id(item);
+        by_id[id] = std::move(item);
+    }
+
+    std::vector<std::string> results(payloads.size());
+    for(size_t i = 0; i < payloads.size(); ++i)
+    {
+        std::string id = member_id(payloads[i]);
+        if(id.empty())
+            continue;
+        auto it = by_id.find(id);
+        if(it != by_id.end())
+            results[i] = std::move(it->second);
+        else
+        {
+            // thrown in place: a copy, as make_exception_ptr makes, would
+            // share the message buffer of the error
+            try
+            {
+                throw ERROR("No response for the request in the batch");
+            }
+            catch(...)
+            {
+                errors[i] = std::current_exception();
+            }
+        }
+    }
+    return results;
+}
+
+}
+
+#undef ERROR
@@ -0,0 +1,141 @@
+/*
+ * batcher.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_BATCHER_H
+#define CURLPP_BATCHER_H
+
+#include "pool.h"
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Collects small calls to an endpoint that accepts batched payloads and sends
+// them as one POST request.
+//
+// A batch is sent as soon as it holds `max_items` calls or its oldest call
+// has waited `max_delay`. A background thread runs up to `max_in_flight`
+// batch requests at once on a multi handle, with handles from the pool;
+// calls arriving meanwhile form the next batches. If a batch fails as a
+// whole, every call in it gets the exception.
+class batcher
+{
+public:
+    // builds the request body from the payloads of a batch
+    typedef std::function<std::string(const std::vector<std::string>& payloads)> encoder;
+
+    // splits a response body into one response per payload, in payload
+    // order; a call the body holds no response for is failed by setting its
+    // entry of `errors`, which comes sized like `payloads`
+    typedef std::function<std::vector<std::string>(
+        const std::vector<std::string>& payloads, const std::string& body,
+        std::vector<std::exception_ptr>& errors)> decoder;
+
+    struct options
+    {
+        size_t max_items = 64;
+        std::chrono::microseconds max_delay = std::chrono::microseconds(500);
+        size_t max_in_flight = 4;       // batch requests running at once
+        std::string content_type = "application/json";
+    };
+
+    batcher(pool& handles, std::string address, options opts,
+            encoder enc, decoder dec);
+    ~batcher();
+
+    batcher(const batcher& other) = delete;
+    batcher& operator = (const batcher& other) = delete;
+
+    std::future<std::string> call(std::string payload);
+
+    // send whatever is queued without waiting for `max_delay`
+    void flush();
+
+private:
+    struct call_
+    {
+        std::string payload;
+        std::promise<std::string> result;
+    };
+
+    struct flight_;
+
+    typedef std::chrono::steady_clock clock;
+
+    pool& handles_;
+    std::string address_;
+    options opts_;
+    encoder encode_;
+    decoder decode_;
+
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::vector<call_> queue_;
+    clock::time_point oldest_;
+    bool flush_;
+    bool running_;
+
+    // only touched by the background thread
+    multi multi_;
+    std::map<CURL *, std::unique_ptr<flight_>> flights_;
+
+    std::thread thread_;
+
+    void run_();
+    bool due_() const;
+    void start_(std::vector<call_>& batch);
+    void finish_(CURL * handle, CURLcode result);
+    static void fail_(std::vector<call_>& batch, std::exception_ptr exc);
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// codecs for batcher
+
+// payloads joined into a JSON array
+std::string json_array_encode(const std::vector<std::string>& payloads);
+
+// elements of a JSON array response, matched to payloads by position
+std::vector<std::string> json_array_decode(
+    const std::vector<std::string>& payloads, const std::string& body,
+    std::vector<std::exception_ptr>& errors);
+
+// JSON-RPC 2.0 batch response, matched to requests by their "id" member, as
+// servers may answer in any order; notifications get an empty response, and
+// requests the server did not answer fail
+std::vector<std::string> json_rpc_decode(
+    const std::vector<std::string>& payloads, const std::string& body,
+    std::vector<std::exception_ptr>& errors);
+
+}
+
+#endif /* CURLPP_BATCHER_H */
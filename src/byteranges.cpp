@@ -0,0 +1,330 @@
+/*
+ * byteranges.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "byteranges.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+namespace
+{
+    // part headers are tiny; anything larger is not a byteranges body
+    constexpr size_t max_part_headers = 16 * 1024;
+
+    bool starts_with_nocase(const char * str, size_t len, const char * prefix)
+    {
+        size_t plen = strlen(prefix);
+        return len >= plen && strncasecmp(str, prefix, plen) == 0;
+    }
+
+    size_t find_nocase(const std::string& str, const char * needle)
+    {
+        size_t nlen = strlen(needle);
+        for(size_t i = 0; i + nlen <= str.size(); ++i)
+            if(strncasecmp(str.data() + i, needle, nlen) == 0)
+                return i;
+        return std::string::npos;
+    }
+
+    // first byte position of a "Content-Range: bytes a-b/c" value
+    curl_off_t parse_range(const char * value)
+    {
+        while(*value == ' ' || *value == '\t')
+            ++value;
+        if(strncasecmp(value, "bytes", 5) == 0)
+            value += 5;
+        return strtoll(value, nullptr, 10);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+byteranges_sink::byteranges_sink(range_callback cb)
+    : cb_(std::move(cb))
+    , accept_full_(false)
+    , status_(0)
+{
+    reset_();
+}
+
+void byteranges_sink::attach(easy& handle, bool accept_full)
+{
+    accept_full_ = accept_full;
+    status_ = 0;
+    handle.set(CURLOPT_HEADERDATA, this);
+    handle.set(CURLOPT_HEADERFUNCTION, byteranges_sink::header_cb_);
+}
+
+void byteranges_sink::write(const char * data, size_t size)
+{
+    check_status_();
+
+    if(phase_ == in_single)
+    {
+        ranges_ = 1;
+        emit_(data, size);
+        return;
+    }
+
+    while(size)
+    {
+        size_t n;
+        switch(phase_)
+        {
+        case in_preamble:
+        case in_body:
+            n = scan_(data, size);
+            break;
+        case in_headers:
+            n = headers_part_(data, size);
+            break;
+        default:
+            return;
+        }
+        data += n;
+        size -= n;
+    }
+}
+
+void byteranges_sink::finish()
+{
+    check_status_();
+    if(phase_ != in_single && phase_ != in_epilogue)
+        throw ERROR("Truncated multipart/byteranges response");
+}
+
+byteranges_sink::range_callback byteranges_sink::to_file(FILE * file)
+{
+    return [file](curl_off_t offset, const char * data, size_t size)
+    {
+#ifdef _WIN32
+        int rc = _fseeki64(file, offset, SEEK_SET);
+#else
+        int rc = fseeko(file, offset, SEEK_SET);
+#endif
+        if(rc != 0 || fwrite(data, 1, size, file) != size)
+            throw ERROR("Failed to write range to file");
+    };
+}
+
+byteranges_sink::range_callback byteranges_sink::to_buffer(char * buffer, size_t size)
+{
+    return [buffer, size](curl_off_t offset, const char * data, size_t len)
+    {
+        if(offset < 0 || static_cast<size_t>(offset) > size
+                      || len > size - offset)
+            throw ERROR("Range outside of target buffer");
+        memcpy(buffer + offset, data, len);
+    };
+}
+
+std::string byteranges_sink::boundary_of(const std::string& content_type)
+{
+    size_t pos = find_nocase(content_type, "boundary=");
+    if(pos == std::string::npos)
+        return std::string();
+    pos += sizeof("boundary=") - 1;
+
+    if(pos < content_type.size() && content_type[pos] == '"')
+    {
+        size_t end = content_type.find('"', pos + 1);
+        return content_type.substr(pos + 1, end - pos - 1);
+    }
+
+    size_t end = content_type.find_first_of("; \t\r\n", pos);
+    return content_type.substr(pos, end - pos);
+}
+
+void byteranges_sink::reset_()
+{
+    phase_ = in_single;
+    delim_.clear();
+    tail_.clear();
+    headers_.clear();
+    offset_ = 0;
+    ranges_ = 0;
+}
+
+void byteranges_sink::check_status_() const
+{
+    // 0: no status line, e.g. a file:// range
+    if(status_ == 206 || status_ == 0 || (status_ == 200 && accept_full_))
+        return;
+    throw ERROR("Unexpected HTTP status in response to a range request");
+}
+
+void byteranges_sink::header_(const char * data, size_t size)
+{
+    // a new status line starts the headers of another response, e.g. after
+    // a redirect or a 100 Continue
+    if(starts_with_nocase(data, size, "HTTP/"))
+    {
+        reset_();
+        const char * code = static_cast<const char *>(memchr(data, ' ', size));
+        status_ = code ? strtol(code + 1, nullptr, 10) : -1;
+    }
+    else if(starts_with_nocase(data, size, "Content-Type:"))
+    {
+        std::string value(data + 13, size - 13);
+        std::string boundary = boundary_of(value);
+        if(find_nocase(value, "multipart/byteranges") != std::string::npos
+                && !boundary.empty())
+        {
+            phase_ = in_preamble;
+            delim_ = "\r\n--" + boundary;
+
+            // lets a delimiter at the very start of the body match, too
+            tail_ = "\r\n";
+        }
+    }
+    else if(starts_with_nocase(data, size, "Content-Range:"))
+    {
+        std::string value(data + 14, size - 14);
+        offset_ = parse_range(value.c_str());
+    }
+}
+
+size_t byteranges_sink::scan_(const char * data, size_t size)
+{
+    const size_t dlen = delim_.size();
+
+    // bytes held back from the last call may begin a delimiter; resolve
+    // them with the first few bytes of this call's data
+    if(!tail_.empty())
+    {
+        size_t tlen = tail_.size();
+        std::string joint = tail_;
+        joint.append(data, std::min(size, dlen));
+
+        for(size_t p = 0; p < tlen; ++p)
+        {
+            size_t cmp = std::min(joint.size() - p, dlen);
+            if(joint.compare(p, cmp, delim_, 0, cmp) != 0)
+                continue;
+
+            emit_(joint.data(), p);
+            if(cmp == dlen)
+            {
+                tail_.clear();
+                delimiter_();
+                return p + dlen - tlen;
+            }
+
+            // still undecided, all of `data` was needed to get here
+            tail_ = joint.substr(p);
+            return size;
+        }
+
+        emit_(tail_.data(), tlen);
+        tail_.clear();
+    }
+
+    // memchr is vectorized by the C library; only candidate positions are
+    // compared against the whole delimiter
+    const char * pos = data;
+    const char * end = data + size;
+    while((pos = static_cast<const char *>(memchr(pos, delim_[0], end - pos))))
+    {
+        size_t cmp = std::min<size_t>(end - pos, dlen);
+        if(memcmp(pos, delim_.data(), cmp) != 0)
+        {
+            ++pos;
+            continue;
+        }
+
+        emit_(data, pos - data);
+        if(cmp < dlen)
+        {
+            tail_.assign(pos, cmp);
+            return size;
+        }
+        delimiter_();
+        return pos - data + dlen;
+    }
+
+    emit_(data, size);
+    return size;
+}
+
+size_t byteranges_sink::headers_part_(const char * data, size_t size)
+{
+    size_t before = headers_.size();
+    headers_.append(data, size);
+
+    if(headers_.size() < 2)
+        return size;
+    if(headers_[0] == '-' && headers_[1] == '-')
+    {
+        // closing delimiter; ignore the epilogue
+        phase_ = in_epilogue;
+        return size;
+    }
+
+    size_t end = headers_.find("\r\n\r\n", before < 3 ? 0 : before - 3);
+    if(end == std::string::npos)
+    {
+        if(headers_.size() > max_part_headers)
+            throw ERROR("Oversized part headers in multipart/byteranges response");
+        return size;
+    }
+
+    offset_ = range_start_(headers_);
+    ++ranges_;
+    phase_ = in_body;
+    return end + 4 - before;
+}
+
+void byteranges_sink::emit_(const char * data, size_t size)
+{
+    if(size == 0 || (phase_ != in_body && phase_ != in_single))
+        return;
+    cb_(offset_, data, size);
+    offset_ += size;
+}
+
+void byteranges_sink::delimiter_()
+{
+    headers_.clear();
+    phase_ = in_headers;
+}
+
+curl_off_t byteranges_sink::range_start_(const std::string& headers)
+{
+    size_t pos = find_nocase(headers, "\r\nContent-Range:");
+    if(pos == std::string::npos)
+        throw ERROR("Part without Content-Range in multipart/byteranges response");
+    return parse_range(headers.c_str() + pos + 16);
+}
+
+size_t byteranges_sink::header_cb_(char * ptr, size_t size, size_t nmemb, void * arg)
+{
+    static_cast<byteranges_sink *>(arg)->header_(ptr, size*nmemb);
+    return size*nmemb;
+}
+
+}
+
+#undef ERROR
@@ -0,0 +1,109 @@
+/*
+ * byteranges.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_BYTERANGES_H
+#define CURLPP_BYTERANGES_H
+
+#include "curl++.h"
+#include <cstdio>
+#include <functional>
+#include <string>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Sink for responses to multi-range requests (CURLOPT_RANGE "0-99,500-599").
+//
+// A multipart/byteranges body is split into its parts as it arrives, and
+// each part's bytes are passed on together with their offset in the remote
+// resource, without buffering the body. Servers may also answer with a
+// single 206 part, which is handled as one range starting at the offset
+// given by Content-Range. Any other status ends the transfer with an error
+// before a byte is passed on, so error pages never end up in the target;
+// a 200 with the whole resource is only accepted if `attach` was told that
+// the requested ranges cover all of it.
+//
+// `attach` has to be called before the transfer, as the status, multipart
+// boundary and ranges are taken from the response headers.
+class byteranges_sink
+    : public sink
+{
+public:
+    typedef std::function<void(curl_off_t offset, const char * data, size_t size)> range_callback;
+
+    explicit byteranges_sink(range_callback cb);
+
+    // Set the header callback on `handle`. `accept_full` allows a 200
+    // response, written as one range at offset 0; only pass true if the
+    // requested ranges start at 0 and reach the end of the resource.
+    void attach(easy& handle, bool accept_full = false);
+
+    virtual void write(const char * data, size_t size);
+    virtual void finish();
+
+    // number of ranges seen so far
+    inline size_t ranges() const
+    { return ranges_; }
+
+    // write every range to its offset in `file`
+    static range_callback to_file(FILE * file);
+
+    // copy every range to its offset in a buffer of `size` bytes
+    static range_callback to_buffer(char * buffer, size_t size);
+
+    // "boundary" parameter of a Content-Type value, or an empty string
+    static std::string boundary_of(const std::string& content_type);
+
+private:
+    enum phase_
+    {
+        in_single,      // not multipart; everything is one range
+        in_preamble,    // before the first delimiter
+        in_headers,     // part headers
+        in_body,        // part body
+        in_epilogue,    // after the closing delimiter
+    };
+
+    range_callback cb_;
+    bool accept_full_;
+    long status_;           // of the current response, 0 before the first
+    phase_ phase_;
+    std::string delim_;     // "\r\n--" boundary
+    std::string tail_;      // possible start of a delimiter held back
+    std::string headers_;
+    curl_off_t offset_;
+    size_t ranges_;
+
+    void reset_();
+    void check_status_() const;
+    void header_(const char * data, size_t size);
+    size_t scan_(const char * data, size_t size);
+    size_t headers_part_(const char * data, size_t size);
+    void emit_(const char * data, size_t size);
+    void delimiter_();
+
+    static curl_off_t range_start_(const std::string& headers);
+    static size_t header_cb_(char *, size_t, size_t, void *);
+};
+
+}
+
+#endif /* CURLPP_BYTERANGES_H */
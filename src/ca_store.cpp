@@ -0,0 +1,152 @@
+/*
+ * ca_store.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ca_store.h"
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+// one loaded bundle on disk; the file goes away with the object
+class ca_store::snapshot_
+{
+public:
+    explicit snapshot_(const std::string& pem)
+    {
+        const char * dir = getenv("TMPDIR");
+        path_ = std::string(dir && *dir ? dir : "/tmp") + "/curlpp-ca-XXXXXX";
+
+        int fd = mkstemp(&path_[0]);
+        if(fd < 0)
+            throw ERROR("Failed to create CA bundle snapshot");
+
+        const char * data = pem.data();
+        size_t left = pem.size();
+        while(left)
+        {
+            ssize_t n = ::write(fd, data, left);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+            {
+                close(fd);
+                unlink(path_.c_str());
+                throw ERROR("Failed to write CA bundle snapshot");
+            }
+            data += n;
+            left -= n;
+        }
+        close(fd);
+    }
+
+    ~snapshot_()
+    {
+        unlink(path_.c_str());
+    }
+
+    snapshot_(const snapshot_& other) = delete;
+    snapshot_& operator = (const snapshot_& other) = delete;
+
+    inline const std::string& path() const
+    { return path_; }
+
+private:
+    std::string path_;
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+ca_store& ca_store::global()
+{
+    static ca_store store;
+    return store;
+}
+
+ca_store::ca_store()
+    : cache_timeout_(-1)
+{}
+
+ca_store::ca_store(const std::string& path)
+    : cache_timeout_(-1)
+{
+    load(path);
+}
+
+void ca_store::load(const std::string& path)
+{
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if(!file)
+        throw ERROR("Failed to open CA bundle");
+
+    std::ostringstream pem;
+    pem << file.rdbuf();
+    if(file.bad())
+        throw ERROR("Failed to read CA bundle");
+
+    load_pem(pem.str());
+}
+
+void ca_store::load_pem(std::string pem)
+{
+    std::shared_ptr<const snapshot_> snapshot = std::make_shared<const snapshot_>(pem);
+
+    // handles configured earlier may still open the older files
+    std::lock_guard<std::mutex> lock(mutex_);
+    snapshots_.push_back(snapshot);
+    std::atomic_store(&current_, snapshot);
+}
+
+void ca_store::cache_timeout(long secs)
+{
+    cache_timeout_ = secs;
+}
+
+void ca_store::apply(easy& handle) const
+{
+    std::shared_ptr<const snapshot_> snapshot = std::atomic_load(&current_);
+    if(!snapshot)
+        return;
+
+    // a file path, not a blob: libcurl only caches CA stores read from files
+    handle.set(CURLOPT_CAINFO, snapshot->path());
+
+#if LIBCURL_VERSION_NUM >= 0x075700
+    long timeout = cache_timeout_;
+    if(timeout >= 0)
+        handle.set(CURLOPT_CA_CACHE_TIMEOUT, timeout);
+#endif
+}
+
+bool ca_store::empty() const
+{
+    return !std::atomic_load(&current_);
+}
+
+}
+
+#undef ERROR
@@ -0,0 +1,87 @@
+/*
+ * ca_store.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_CA_STORE_H
+#define CURLPP_CA_STORE_H
+
+#include "curl++.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// CA bundle shared by handles through CURLOPT_CAINFO.
+//
+// Each loaded bundle is written once to a private snapshot file, and all
+// handles point CURLOPT_CAINFO at it. Unlike CURLOPT_CAINFO_BLOB, which
+// libcurl parses again for every connection and copies into every handle,
+// a CA file lets libcurl keep the parsed X509 store for
+// CURLOPT_CA_CACHE_TIMEOUT and reuse it for later connections of transfers
+// driven by the same multi handle.
+//
+// `load` may be called at any time to pick up a rotated bundle. It writes a
+// new snapshot under a new name, so the cached store of the old one is not
+// reused; handles configured afterwards see the new bundle, handles
+// configured before keep the one they were given. Snapshot files are
+// removed when the store is destroyed.
+class ca_store
+{
+public:
+    // process-wide store, empty until the first `load`
+    static ca_store& global();
+
+    ca_store();
+    explicit ca_store(const std::string& path);
+
+    ca_store(const ca_store& other) = delete;
+    ca_store& operator = (const ca_store& other) = delete;
+
+    // read a PEM bundle from `path` and replace the current one
+    void load(const std::string& path);
+    void load_pem(std::string pem);
+
+    // CURLOPT_CA_CACHE_TIMEOUT: how long libcurl may keep the parsed
+    // snapshot around for reuse by later connections; -1 leaves libcurl's
+    // default (24 hours)
+    void cache_timeout(long secs);
+
+    // set CURLOPT_CAINFO (and the cache timeout) on `handle`; does nothing
+    // while the store is empty
+    void apply(easy& handle) const;
+
+    bool empty() const;
+
+private:
+    class snapshot_;
+
+    std::shared_ptr<const snapshot_> current_;
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<const snapshot_>> snapshots_;  // all files handed out
+    std::atomic<long> cache_timeout_;
+};
+
+}
+
+#endif /* CURLPP_CA_STORE_H */
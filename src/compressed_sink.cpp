@@ -0,0 +1,431 @@
+/*
+ * compressed_sink.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "compressed_sink.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+namespace
+{
+    const char index_magic[8] = {'c', 'u', 'r', 'l', 'c', 'z', 'i', '1'};
+
+    struct index_header
+    {
+        char magic[8];
+        uint32_t format;
+        uint32_t reserved;
+        uint64_t count;
+    };
+
+    void write_all(int fd, const char * data, size_t size)
+    {
+        while(size)
+        {
+            ssize_t n = ::write(fd, data, size);
+            if(n <= 0)
+                throw ERROR("Failed to write compressed file");
+            data += n;
+            size -= n;
+        }
+    }
+
+    void read_all(int fd, void * data, size_t size, off_t offset)
+    {
+        char * ptr = static_cast<char *>(data);
+        while(size)
+        {
+            ssize_t n = pread(fd, ptr, size, offset);
+            if(n <= 0)
+                throw ERROR("Failed to read compressed file");
+            ptr += n;
+            size -= n;
+            offset += n;
+        }
+    }
+
+    // compress `src` into a single gzip member appended to `dst`
+    void gzip_block(z_stream& zs, const std::string& src, std::string& dst)
+    {
+        if(deflateReset(&zs) != Z_OK)
+            throw ERROR("Failed to reset deflate stream");
+
+        size_t pos = dst.size();
+        dst.resize(pos + deflateBound(&zs, src.size()) + 32);
+        zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(src.data()));
+        zs.avail_in = src.size();
+        zs.next_out = reinterpret_cast<Bytef *>(&dst[pos]);
+        zs.avail_out = dst.size() - pos;
+        if(deflate(&zs, Z_FINISH) != Z_STREAM_END)
+            throw ERROR("Failed to deflate block");
+        dst.resize(dst.size() - zs.avail_out);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+compressed_sink::compressed_sink(const std::string& path)
+    : compressed_sink(path, options())
+{}
+
+compressed_sink::compressed_sink(const std::string& path, options opts)
+    : path_(path)
+    , opts_(opts)
+    , fd_(-1)
+    , raw_size_(0)
+    , closed_(false)
+    , written_(0)
+{
+    opts_.block_size = std::max<size_t>(opts_.block_size, 4096);
+    opts_.write_size = std::max<size_t>(opts_.write_size / 4096, 1) * 4096;
+    opts_.max_pending = std::max<size_t>(opts_.max_pending, 1);
+
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd_ < 0)
+        throw ERROR("Failed to open compressed file");
+
+    block_.reserve(opts_.block_size);
+    worker_ = std::thread(&compressed_sink::run_, this);
+}
+
+compressed_sink::~compressed_sink()
+{
+    stop_();
+    if(fd_ >= 0)
+        close(fd_);
+}
+
+void compressed_sink::write(const char * data, size_t size)
+{
+    raw_size_ += size;
+    while(size)
+    {
+        size_t len = std::min(size, opts_.block_size - block_.size());
+        block_.append(data, len);
+        data += len;
+        size -= len;
+
+        if(block_.size() == opts_.block_size)
+            submit_();
+    }
+}
+
+void compressed_sink::finish()
+{
+    if(!block_.empty())
+        submit_();
+    stop_();
+
+    if(exc_)
+        std::rethrow_exception(exc_);
+    if(fd_ < 0)
+        return;
+
+    flush_(true);
+    write_index_();
+    if(close(fd_) != 0)
+    {
+        fd_ = -1;
+        throw ERROR("Failed to close compressed file");
+    }
+    fd_ = -1;
+}
+
+void compressed_sink::submit_()
+{
+    std::string next;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this]{
+            return queue_.size() < opts_.max_pending || exc_;
+        });
+        if(exc_)
+        {
+            // the worker gave up; report its error to the writer
+            lock.unlock();
+            block_.clear();
+            std::rethrow_exception(exc_);
+        }
+
+        queue_.push_back(std::move(block_));
+        if(!spare_.empty())
+        {
+            next = std::move(spare_.back());
+            spare_.pop_back();
+        }
+        changed_.notify_all();
+    }
+
+    next.clear();
+    next.reserve(opts_.block_size);
+    block_ = std::move(next);
+}
+
+void compressed_sink::stop_()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        changed_.notify_all();
+    }
+    if(worker_.joinable())
+        worker_.join();
+}
+
+void compressed_sink::run_()
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    ZSTD_CCtx * cctx = nullptr;
+
+    try
+    {
+        if(opts_.format == gzip)
+        {
+            // windowBits + 16 selects the gzip wrapper
+            if(deflateInit2(&zs, opts_.level, Z_DEFLATED, 15 + 16, 8,
+                            Z_DEFAULT_STRATEGY) != Z_OK)
+                throw ERROR("Failed to initialize deflate stream");
+        }
+        else if((cctx = ZSTD_createCCtx()) == nullptr)
+            throw ERROR("Failed to create zstd context");
+
+        for(;;)
+        {
+            std::string block;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                changed_.wait(lock, [this]{ return !queue_.empty() || closed_; });
+                if(queue_.empty())
+                    break;
+                block = std::move(queue_.front());
+                queue_.pop_front();
+                changed_.notify_all();
+            }
+
+            compress_(block, opts_.format == gzip ?
+                      static_cast<void *>(&zs) : static_cast<void *>(cctx));
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(spare_.size() < opts_.max_pending)
+                spare_.push_back(std::move(block));
+        }
+    }
+    catch(...)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        exc_ = std::current_exception();
+        queue_.clear();
+        changed_.notify_all();
+    }
+
+    if(opts_.format == gzip)
+        deflateEnd(&zs);
+    ZSTD_freeCCtx(cctx);
+}
+
+void compressed_sink::compress_(const std::string& block, void * ctx)
+{
+    entry_ e;
+    e.raw_offset = index_.empty() ? 0 :
+        index_.back().raw_offset + index_.back().raw_size;
+    e.file_offset = written_ + out_.size();
+    e.raw_size = block.size();
+
+    size_t pos = out_.size();
+    if(opts_.format == gzip)
+        gzip_block(*static_cast<z_stream *>(ctx), block, out_);
+    else
+    {
+        out_.resize(pos + ZSTD_compressBound(block.size()));
+        size_t n = ZSTD_compressCCtx(static_cast<ZSTD_CCtx *>(ctx),
+                                     &out_[pos], out_.size() - pos,
+                                     block.data(), block.size(), opts_.level);
+        if(ZSTD_isError(n))
+            throw ERROR("Failed to compress block");
+        out_.resize(pos + n);
+    }
+
+    e.file_size = out_.size() - pos;
+    index_.push_back(e);
+    flush_(false);
+}
+
+void compressed_sink::flush_(bool all)
+{
+    // write whole multiples of write_size, keep the rest for later
+    size_t len = all ? out_.size() :
+        out_.size() / opts_.write_size * opts_.write_size;
+    if(len == 0)
+        return;
+
+    write_all(fd_, out_.data(), len);
+    written_ += len;
+    out_.erase(0, len);
+}
+
+void compressed_sink::write_index_()
+{
+    index_header h;
+    memcpy(h.magic, index_magic, sizeof(h.magic));
+    h.format = opts_.format;
+    h.reserved = 0;
+    h.count = index_.size();
+
+    std::string idx = path_ + ".idx";
+    int fd = open(idx.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0)
+        throw ERROR("Failed to open block index");
+
+    try
+    {
+        write_all(fd, reinterpret_cast<const char *>(&h), sizeof(h));
+        write_all(fd, reinterpret_cast<const char *>(index_.data()),
+                  index_.size() * sizeof(entry_));
+    }
+    catch(...)
+    {
+        close(fd);
+        throw;
+    }
+    close(fd);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+compressed_reader::compressed_reader(const std::string& path)
+    : fd_(-1)
+{
+    std::string idx = path + ".idx";
+    int ifd = open(idx.c_str(), O_RDONLY | O_CLOEXEC);
+    if(ifd < 0)
+        throw ERROR("Failed to open block index");
+
+    try
+    {
+        index_header h;
+        read_all(ifd, &h, sizeof(h), 0);
+        if(memcmp(h.magic, index_magic, sizeof(h.magic)) != 0 || h.format > 1)
+            throw ERROR("Invalid block index");
+
+        format_ = static_cast<compressed_sink::codec>(h.format);
+        index_.resize(h.count);
+        if(h.count)
+            read_all(ifd, index_.data(), h.count * sizeof(entry_), sizeof(h));
+    }
+    catch(...)
+    {
+        close(ifd);
+        throw;
+    }
+    close(ifd);
+
+    fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd_ < 0)
+        throw ERROR("Failed to open compressed file");
+}
+
+compressed_reader::~compressed_reader()
+{
+    if(fd_ >= 0)
+        close(fd_);
+}
+
+size_t compressed_reader::blocks() const
+{
+    return index_.size();
+}
+
+uint64_t compressed_reader::size() const
+{
+    return index_.empty() ? 0 :
+        index_.back().raw_offset + index_.back().raw_size;
+}
+
+std::string compressed_reader::block(size_t index) const
+{
+    if(index >= index_.size())
+        throw ERROR("Block index out of range");
+
+    const entry_& e = index_[index];
+    std::string src(e.file_size, '\0');
+    read_all(fd_, &src[0], src.size(), e.file_offset);
+
+    std::string dst(e.raw_size, '\0');
+    if(format_ == compressed_sink::gzip)
+    {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        if(inflateInit2(&zs, 15 + 16) != Z_OK)
+            throw ERROR("Failed to initialize inflate stream");
+        zs.next_in = reinterpret_cast<Bytef *>(&src[0]);
+        zs.avail_in = src.size();
+        zs.next_out = reinterpret_cast<Bytef *>(&dst[0]);
+        zs.avail_out = dst.size();
+        int rc = inflate(&zs, Z_FINISH);
+        inflateEnd(&zs);
+        if(rc != Z_STREAM_END || zs.avail_out != 0)
+            throw ERROR("Failed to inflate block");
+    }
+    else
+    {
+        size_t n = ZSTD_decompress(&dst[0], dst.size(), src.data(), src.size());
+        if(ZSTD_isError(n) || n != dst.size())
+            throw ERROR("Failed to decompress block");
+    }
+    return dst;
+}
+
+std::string compressed_reader::read(uint64_t offset, size_t size) const
+{
+    std::string result;
+    if(offset >= this->size())
+        return result;
+
+    // first block whose range ends after `offset`
+    auto it = std::upper_bound(index_.begin(), index_.end(), offset,
+        [](uint64_t off, const entry_& e) {
+            return off < e.raw_offset + e.raw_size;
+        });
+
+    result.reserve(size);
+    for(; it != index_.end() && result.size() < size; ++it)
+    {
+        std::string data = block(it - index_.begin());
+        size_t skip = offset > it->raw_offset ? offset - it->raw_offset : 0;
+        size_t len = std::min<size_t>(data.size() - skip, size - result.size());
+        result.append(data, skip, len);
+    }
+    return result;
+}
+
+}
+
+#undef ERROR
@@ -0,0 +1,159 @@
+/*
+ * compressed_sink.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_COMPRESSED_SINK_H
+#define CURLPP_COMPRESSED_SINK_H
+
+#include "curl++.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Sink storing the body compressed, in independently compressed blocks.
+//
+// The body is cut into blocks of `block_size` bytes, which a worker thread
+// compresses into one zstd frame or gzip member each. Concatenated frames
+// (members) form a regular .zst (.gz) file that standard tools can read.
+// Compressed data is written in multiples of `write_size` bytes, so all
+// writes but the last are large and start at aligned file offsets.
+//
+// A block index is written to `<path>.idx` on finish; `compressed_reader`
+// uses it to decompress single blocks or byte ranges without reading the
+// blocks before them.
+class compressed_sink
+    : public sink
+{
+public:
+    enum codec
+    {
+        zstd,
+        gzip,
+    };
+
+    struct options
+    {
+        codec format = zstd;
+        int level = 3;
+        size_t block_size = 1024 * 1024;
+        size_t write_size = 1024 * 1024;
+        size_t max_pending = 4;     // blocks queued for the worker
+    };
+
+    explicit compressed_sink(const std::string& path);
+    compressed_sink(const std::string& path, options opts);
+    ~compressed_sink();
+
+    compressed_sink(const compressed_sink& other) = delete;
+    compressed_sink& operator = (const compressed_sink& other) = delete;
+
+    virtual void write(const char * data, size_t size);
+
+    // compress the last block, wait for the worker and write the index;
+    // rethrows errors from the worker
+    virtual void finish();
+
+    inline uint64_t raw_size() const
+    { return raw_size_; }
+
+private:
+    struct entry_
+    {
+        uint64_t raw_offset;
+        uint64_t file_offset;
+        uint32_t file_size;
+        uint32_t raw_size;
+    };
+
+    std::string path_;
+    options opts_;
+    int fd_;
+    std::string block_;
+    uint64_t raw_size_;
+
+    // shared with the worker
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::deque<std::string> queue_;
+    std::vector<std::string> spare_;
+    bool closed_;
+    std::exception_ptr exc_;
+    std::thread worker_;
+
+    // worker only
+    std::string out_;
+    std::vector<entry_> index_;
+    uint64_t written_;
+
+    void submit_();
+    void run_();
+    void compress_(const std::string& block, void * ctx);
+    void flush_(bool all);
+    void write_index_();
+    void stop_();
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// random access to files written by compressed_sink
+class compressed_reader
+{
+public:
+    explicit compressed_reader(const std::string& path);
+    ~compressed_reader();
+
+    compressed_reader(const compressed_reader& other) = delete;
+    compressed_reader& operator = (const compressed_reader& other) = delete;
+
+    size_t blocks() const;
+    uint64_t size() const;
+
+    // decompressed content of block `index`
+    std::string block(size_t index) const;
+
+    // `size` bytes starting at uncompressed `offset`
+    std::string read(uint64_t offset, size_t size) const;
+
+private:
+    struct entry_
+    {
+        uint64_t raw_offset;
+        uint64_t file_offset;
+        uint32_t file_size;
+        uint32_t raw_size;
+    };
+
+    int fd_;
+    compressed_sink::codec format_;
+    std::vector<entry_> index_;
+};
+
+}
+
+#endif /* CURLPP_COMPRESSED_SINK_H */
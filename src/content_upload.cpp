@@ -0,0 +1,172 @@
+/*
+ * content_upload.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "content_upload.h"
+#include <algorithm>
+#include <cstring>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+namespace
+{
+    size_t discard(char *, size_t size, size_t nmemb, void *)
+    {
+        return size*nmemb;
+    }
+
+    // state of a streaming upload: hashes each block as it is handed to
+    // libcurl, so hashing overlaps with the network transfer
+    struct stream_
+    {
+        explicit stream_(const mapped_file& src)
+            : source(&src)
+            , pos(0)
+            , hash(digest::sha256)
+        {}
+
+        const mapped_file * source;
+        size_t pos;
+        digest hash;
+        std::string raw;
+        std::string trailer;
+    };
+
+    size_t read_hashing(char * ptr, size_t size, size_t nmemb, void * arg)
+    {
+        stream_ * s = static_cast<stream_ *>(arg);
+        size_t len = std::min(size*nmemb, s->source->size() - s->pos);
+        const char * data = s->source->data() + s->pos;
+
+        s->hash.update(data, len);
+        memcpy(ptr, data, len);
+        s->pos += len;
+        return len;
+    }
+
+    int trailer(curl_slist ** list, void * arg)
+    {
+        stream_ * s = static_cast<stream_ *>(arg);
+        s->raw = s->hash.finish();
+        s->trailer = "Content-Digest: sha-256=:" + digest::base64(s->raw) + ":";
+        *list = curl_slist_append(*list, s->trailer.c_str());
+        return CURL_TRAILERFUNC_OK;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+content_upload::content_upload(pool& handles, options opts)
+    : handles_(handles)
+    , opts_(std::move(opts))
+{}
+
+content_upload::result content_upload::upload(const std::string& target,
+                                              const std::string& path)
+{
+    mapped_file source(path);
+    source.sequential();
+
+    if(opts_.mode == none)
+        return put_streaming_(target, source);
+
+    std::string raw = digest::of(digest::sha256, source.data(), source.size());
+    if(opts_.mode == head_path && present_(digest::hex(raw)))
+        return result{true, 200, digest::hex(raw)};
+
+    return put_(target, source, raw);
+}
+
+bool content_upload::present_(const std::string& hex)
+{
+    pool::lease handle = handles_.acquire(opts_.check_prefix + hex);
+    handle->set(CURLOPT_NOBODY, 1L);
+    handle->perform();
+    return handle->info<long>(CURLINFO_RESPONSE_CODE) == 200;
+}
+
+content_upload::result content_upload::put_(const std::string& target,
+                                            const mapped_file& source,
+                                            const std::string& raw)
+{
+    std::string hex = digest::hex(raw);
+
+    list hdrs;
+    hdrs += "Content-Type: " + opts_.content_type;
+    hdrs += "Content-Digest: sha-256=:" + digest::base64(raw) + ":";
+    if(opts_.mode == if_none_match)
+    {
+        hdrs += "If-None-Match: \"" + hex + "\"";
+        hdrs += "Expect: 100-continue";
+    }
+
+    // POSTFIELDS does not copy; the body is sent from the mapping
+    pool::lease handle = handles_.acquire(target);
+    handle->set(CURLOPT_HTTPHEADER, *hdrs);
+    handle->set(CURLOPT_CUSTOMREQUEST, "PUT");
+    handle->set(CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(source.size()));
+    handle->set(CURLOPT_POSTFIELDS, source.size() ? source.data() : "");
+    handle->set(CURLOPT_WRITEFUNCTION, discard);
+    handle->perform();
+
+    long status = handle->info<long>(CURLINFO_RESPONSE_CODE);
+    if(status == 412 && opts_.mode == if_none_match)
+        return result{true, status, hex};
+    if(status < 200 || status >= 300)
+        throw ERROR("Upload failed with HTTP error status");
+    return result{false, status, hex};
+}
+
+content_upload::result content_upload::put_streaming_(const std::string& target,
+                                                      const mapped_file& source)
+{
+    stream_ state(source);
+
+    list hdrs;
+    hdrs += "Content-Type: " + opts_.content_type;
+    hdrs += "Transfer-Encoding: chunked";
+    hdrs += "Trailer: Content-Digest";
+
+    pool::lease handle = handles_.acquire(target);
+    handle->set(CURLOPT_HTTPHEADER, *hdrs);
+    handle->set(CURLOPT_UPLOAD, 1L);
+    handle->set(CURLOPT_READDATA, static_cast<void *>(&state));
+    handle->set(CURLOPT_READFUNCTION, read_hashing);
+    handle->set(CURLOPT_TRAILERDATA, static_cast<void *>(&state));
+    handle->set(CURLOPT_TRAILERFUNCTION, trailer);
+    handle->set(CURLOPT_WRITEFUNCTION, discard);
+    handle->perform();
+
+    long status = handle->info<long>(CURLINFO_RESPONSE_CODE);
+    if(status < 200 || status >= 300)
+        throw ERROR("Upload failed with HTTP error status");
+
+    // the trailer callback finishes the digest, unless the request did not
+    // end up chunked (HTTP/1.0)
+    if(state.raw.empty())
+        state.raw = state.hash.finish();
+    return result{false, status, digest::hex(state.raw)};
+}
+
+}
+
+#undef ERROR
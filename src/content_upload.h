@@ -0,0 +1,89 @@
+/*
+ * content_upload.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_CONTENT_UPLOAD_H
+#define CURLPP_CONTENT_UPLOAD_H
+
+#include "digest.h"
+#include "mapped_file.h"
+#include "pool.h"
+#include <string>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// PUT uploads that are identified by the SHA-256 of their content.
+//
+// With a check mode, the file is hashed from its memory mapping first and
+// the upload is skipped when the server already has the content:
+//
+//  - `head_path`:      HEAD on `check_prefix` + hex digest; 200 means present
+//  - `if_none_match`:  PUT with `If-None-Match: "<hex digest>"` and
+//                      `Expect: 100-continue`, so a server answering 412
+//                      does so before any of the body is sent
+//
+// Without a check (`none`), the file is hashed while it is being sent, and
+// the digest goes out as a `Content-Digest` trailer of the chunked request.
+// Every upload carries the digest in `Content-Digest` (RFC 9530).
+class content_upload
+{
+public:
+    enum check
+    {
+        none,
+        head_path,
+        if_none_match,
+    };
+
+    struct options
+    {
+        check mode = if_none_match;
+        std::string check_prefix;
+        std::string content_type = "application/octet-stream";
+    };
+
+    struct result
+    {
+        bool skipped;
+        long status;
+        std::string digest;     // hex SHA-256
+    };
+
+    content_upload(pool& handles, options opts);
+
+    content_upload(const content_upload& other) = delete;
+    content_upload& operator = (const content_upload& other) = delete;
+
+    result upload(const std::string& target, const std::string& path);
+
+private:
+    pool& handles_;
+    options opts_;
+
+    bool present_(const std::string& hex);
+    result put_(const std::string& target, const mapped_file& source,
+                const std::string& raw);
+    result put_streaming_(const std::string& target, const mapped_file& source);
+};
+
+}
+
+#endif /* CURLPP_CONTENT_UPLOAD_H */
@@ -20,12 +20,17 @@
 #include "curl++.h"
 #include <algorithm>
 #include <ostream>
+#include <cctype>
+#include <climits>
 #include <cstdio>
 #include <cstring>
+#include <strings.h>
 
 #define CHECK(x) \
-    CURLcode code = (x); \
-    if(code != CURLE_OK) throw error(#x, code, __FILE__, __LINE__);
+    do { \
+        auto code = (x); \
+        if(code != decltype(code)(0)) throw error(#x, code, __FILE__, __LINE__); \
+    } while(0)
 
 #define ERROR(x) \
     error(x, __FILE__, __LINE__)
@@ -46,6 +51,15 @@ init::~init()
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+sink::~sink()
+{}
+
+void sink::finish()
+{}
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 easy::easy()
     : handle_(curl_easy_init())
@@ -61,14 +75,48 @@ easy::easy(CURL * handle)
         throw ERROR("Failed to aquire CURL easy handle");
 }
 
+easy::easy(easy&& other)
+    : handle_(other.handle_)
+{
+    other.handle_ = nullptr;
+}
+
+easy& easy::operator = (easy&& other)
+{
+    swap(other);
+    return *this;
+}
+
 easy::~easy()
 {
     curl_easy_cleanup(handle_);
 }
 
+namespace
+{
+    // libcurl reads a curl_off_t for these, not a long
+    inline bool is_off_t(CURLoption option)
+    {
+        return option >= CURLOPTTYPE_OFF_T && option < CURLOPTTYPE_BLOB;
+    }
+}
+
 void easy::set(CURLoption option, long value)
 {
-    CHECK(curl_easy_setopt(handle_, option, value));
+    if(is_off_t(option))
+        CHECK(curl_easy_setopt(handle_, option, static_cast<curl_off_t>(value)));
+    else
+        CHECK(curl_easy_setopt(handle_, option, value));
+}
+
+void easy::set(CURLoption option, long long value)
+{
+    if(is_off_t(option))
+        CHECK(curl_easy_setopt(handle_, option, static_cast<curl_off_t>(value)));
+    else if(value < LONG_MIN || value > LONG_MAX)
+        throw ERROR("Option value out of range");
+    else
+        CHECK(curl_easy_setopt(handle_, option, static_cast<long>(value)));
 }
 
 void easy::set(CURLoption option, const std::string & value)
@@ -162,6 +210,36 @@ void easy::recv_into(FILE * file)
     perform();
 }
 
+namespace
+{
+    struct sink_state_
+    {
+        sink * out;
+        std::exception_ptr exc;
+    };
+}
+
+void easy::recv_into(sink& out)
+{
+    sink_state_ state{&out, nullptr};
+    set(CURLOPT_WRITEDATA, static_cast<void *>(&state));
+    set(CURLOPT_WRITEFUNCTION, easy::recv_into_writefunc_sink_);
+
+    // exceptions must not cross libcurl's C frames; the write callback
+    // stores them and aborts the transfer, so rethrow them here
+    try
+    {
+        perform();
+    }
+    catch(...)
+    {
+        if(state.exc)
+            std::rethrow_exception(state.exc);
+        throw;
+    }
+    out.finish();
+}
+
 
 bool easy::operator == (const easy& other) const
 {
@@ -213,6 +291,185 @@ size_t easy::recv_into_writefunc_file_(
     return fwrite(ptr, size, nmemb, file);
 }
 
+size_t easy::recv_into_writefunc_sink_(
+    char *ptr, size_t size, size_t nmemb, void * arg)
+{
+    sink_state_ * state = static_cast<sink_state_ *>(arg);
+    try
+    {
+        state->out->write(ptr, size*nmemb);
+    }
+    catch(...)
+    {
+        state->exc = std::current_exception();
+        return 0;
+    }
+    return size*nmemb;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+headers::headers()
+{}
+
+void headers::attach(easy& handle)
+{
+    raw_.clear();
+    handle.set(CURLOPT_HEADERDATA, static_cast<void *>(this));
+    handle.set(CURLOPT_HEADERFUNCTION, headers::callback_);
+}
+
+std::string headers::get(const char * name) const
+{
+    size_t pos = find_(name);
+    if(pos == std::string::npos)
+        return std::string();
+
+    size_t end = raw_.find('\n', pos);
+    if(end == std::string::npos)
+        end = raw_.size();
+
+    while(pos < end && (raw_[pos] == ' ' || raw_[pos] == '\t'))
+        ++pos;
+    while(end > pos && isspace(static_cast<unsigned char>(raw_[end-1])))
+        --end;
+    return raw_.substr(pos, end - pos);
+}
+
+bool headers::has(const char * name) const
+{
+    return find_(name) != std::string::npos;
+}
+
+void headers::clear()
+{
+    raw_.clear();
+}
+
+size_t headers::find_(const char * name) const
+{
+    // position of the value of header `name`
+    size_t len = strlen(name);
+    size_t pos = 0;
+
+    while(pos < raw_.size())
+    {
+        size_t end = raw_.find('\n', pos);
+        if(end == std::string::npos)
+            end = raw_.size();
+
+        if(end - pos > len && raw_[pos+len] == ':'
+                && strncasecmp(raw_.data() + pos, name, len) == 0)
+            return pos + len + 1;
+        pos = end + 1;
+    }
+    return std::string::npos;
+}
+
+size_t headers::callback_(char *ptr, size_t size, size_t nmemb, void * arg)
+{
+    headers * self = static_cast<headers *>(arg);
+    size_t len = size*nmemb;
+
+    if(len >= 5 && strncmp(ptr, "HTTP/", 5) == 0)
+        self->raw_.clear();
+    self->raw_.append(ptr, len);
+    return len;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+multi::multi()
+    : handle_(curl_multi_init())
+{
+    if(handle_ == nullptr)
+        throw ERROR("Failed to aquire CURL multi handle");
+}
+
+multi::multi(multi&& other)
+    : handle_(other.handle_)
+{
+    other.handle_ = nullptr;
+}
+
+multi& multi::operator = (multi&& other)
+{
+    swap(other);
+    return *this;
+}
+
+multi::~multi()
+{
+    curl_multi_cleanup(handle_);
+}
+
+void multi::set(CURLMoption option, long value)
+{
+    CHECK(curl_multi_setopt(handle_, option, value));
+}
+
+void multi::add(easy& handle)
+{
+    add(handle.handle());
+}
+
+void multi::remove(easy& handle)
+{
+    remove(handle.handle());
+}
+
+void multi::add(CURL * handle)
+{
+    CHECK(curl_multi_add_handle(handle_, handle));
+}
+
+void multi::remove(CURL * handle)
+{
+    CHECK(curl_multi_remove_handle(handle_, handle));
+}
+
+int multi::perform()
+{
+    int running = 0;
+    CHECK(curl_multi_perform(handle_, &running));
+    return running;
+}
+
+int multi::socket_action(curl_socket_t socket, int ev_bitmask)
+{
+    int running = 0;
+    CHECK(curl_multi_socket_action(handle_, socket, ev_bitmask, &running));
+    return running;
+}
+
+void multi::poll(int timeout_ms)
+{
+    CHECK(curl_multi_poll(handle_, nullptr, 0, timeout_ms, nullptr));
+}
+
+void multi::wakeup()
+{
+    CHECK(curl_multi_wakeup(handle_));
+}
+
+bool multi::next_done(CURL *& handle, CURLcode& result)
+{
+    int queued;
+    CURLMsg * msg;
+
+    while((msg = curl_multi_info_read(handle_, &queued)))
+    {
+        if(msg->msg != CURLMSG_DONE)
+            continue;
+        handle = msg->easy_handle;
+        result = msg->data.result;
+        return true;
+    }
+    return false;
+}
+
+
 
 ////////////////////////////////////////////////////////////////////////////////
 list::list()
@@ -223,6 +480,18 @@ list::list(curl_slist * sl)
     : list_(sl)
 {}
 
+list::list(list&& other)
+    : list_(other.list_)
+{
+    other.list_ = nullptr;
+}
+
+list& list::operator = (list&& other)
+{
+    swap(other);
+    return *this;
+}
+
 list::~list()
 {
     curl_slist_free_all(list_);
@@ -257,6 +526,285 @@ curl_slist * list::operator * () const
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+mime::mime(easy& handle)
+    : mime_(curl_mime_init(handle.handle()))
+{
+    if(mime_ == nullptr)
+        throw ERROR("Failed to aquire CURL mime handle");
+}
+
+mime::mime(mime&& other)
+    : mime_(other.mime_)
+    , sources_(std::move(other.sources_))
+{
+    other.mime_ = nullptr;
+}
+
+mime& mime::operator = (mime&& other)
+{
+    swap(other);
+    return *this;
+}
+
+mime::~mime()
+{
+    curl_mime_free(mime_);
+}
+
+mime& mime::add_data(const char * name, const std::string& value,
+                     const char * type)
+{
+    curl_mimepart * part = add_part_(name, type, nullptr);
+    CHECK(curl_mime_data(part, value.data(), value.size()));
+    return *this;
+}
+
+mime& mime::add_file(const char * name, const char * path,
+                     const char * type, const char * filename)
+{
+    curl_mimepart * part = add_part_(name, type, nullptr);
+    CHECK(curl_mime_filedata(part, path));
+
+    // curl_mime_filedata sets the remote file name to the basename of `path`
+    if(filename)
+        CHECK(curl_mime_filename(part, filename));
+    return *this;
+}
+
+mime& mime::add_buffer(const char * name, const void * data, size_t size,
+                       const char * type, const char * filename)
+{
+    curl_mimepart * part = add_part_(name, type, filename);
+    sources_.emplace_back(new source_{
+        static_cast<const char *>(data), size, 0, nullptr});
+    CHECK(curl_mime_data_cb(part, size, mime::read_buffer_,
+                            mime::seek_buffer_, nullptr,
+                            sources_.back().get()));
+    return *this;
+}
+
+mime& mime::add_generator(const char * name, generator gen, curl_off_t size,
+                          const char * type, const char * filename)
+{
+    curl_mimepart * part = add_part_(name, type, filename);
+    sources_.emplace_back(new source_{nullptr, 0, 0, std::move(gen)});
+    CHECK(curl_mime_data_cb(part, size, mime::read_generator_,
+                            nullptr, nullptr, sources_.back().get()));
+    return *this;
+}
+
+void mime::attach(easy& handle) const
+{
+    handle.set(CURLOPT_MIMEPOST, mime_);
+}
+
+curl_mime * mime::operator * () const
+{
+    return mime_;
+}
+
+curl_mimepart * mime::add_part_(const char * name, const char * type,
+                                const char * filename)
+{
+    curl_mimepart * part = curl_mime_addpart(mime_);
+    if(part == nullptr)
+        throw ERROR("Failed to add mime part");
+
+    CHECK(curl_mime_name(part, name));
+    if(type)
+        CHECK(curl_mime_type(part, type));
+    if(filename)
+        CHECK(curl_mime_filename(part, filename));
+    return part;
+}
+
+size_t mime::read_buffer_(char *ptr, size_t size, size_t nmemb, void * arg)
+{
+    source_ * src = static_cast<source_ *>(arg);
+    size_t len = std::min(size*nmemb, src->size - src->pos);
+    memcpy(ptr, src->data + src->pos, len);
+    src->pos += len;
+    return len;
+}
+
+int mime::seek_buffer_(void * arg, curl_off_t offset, int origin)
+{
+    source_ * src = static_cast<source_ *>(arg);
+    curl_off_t base = 0;
+
+    switch(origin)
+    {
+    case SEEK_SET: base = 0; break;
+    case SEEK_CUR: base = src->pos; break;
+    case SEEK_END: base = src->size; break;
+    default: return CURL_SEEKFUNC_FAIL;
+    }
+
+    if(base + offset < 0 || static_cast<size_t>(base + offset) > src->size)
+        return CURL_SEEKFUNC_FAIL;
+    src->pos = base + offset;
+    return CURL_SEEKFUNC_OK;
+}
+
+size_t mime::read_generator_(char *ptr, size_t size, size_t nmemb, void * arg)
+{
+    source_ * src = static_cast<source_ *>(arg);
+    return src->gen(ptr, size*nmemb);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+share::share()
+    : share_(curl_share_init())
+{
+    if(share_ == nullptr)
+        throw ERROR("Failed to aquire CURL share handle");
+
+    // without the lock functions the share must not be used from threads
+    CURLSHcode code = curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+    if(code == CURLSHE_OK)
+        code = curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, share::lock_);
+    if(code == CURLSHE_OK)
+        code = curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, share::unlock_);
+    if(code != CURLSHE_OK)
+    {
+        curl_share_cleanup(share_);
+        throw ERROR(curl_share_strerror(code));
+    }
+}
+
+share::~share()
+{
+    curl_share_cleanup(share_);
+}
+
+void share::add(curl_lock_data data)
+{
+    CURLSHcode code = curl_share_setopt(share_, CURLSHOPT_SHARE, data);
+    if(code != CURLSHE_OK)
+        throw ERROR(curl_share_strerror(code));
+}
+
+void share::remove(curl_lock_data data)
+{
+    CURLSHcode code = curl_share_setopt(share_, CURLSHOPT_UNSHARE, data);
+    if(code != CURLSHE_OK)
+        throw ERROR(curl_share_strerror(code));
+}
+
+void share::attach(easy& handle) const
+{
+    handle.set(CURLOPT_SHARE, share_);
+}
+
+CURLSH * share::operator * () const
+{
+    return share_;
+}
+
+void share::lock_(CURL *, curl_lock_data data, curl_lock_access, void * arg)
+{
+    static_cast<share *>(arg)->locks_[data].lock();
+}
+
+void share::unlock_(CURL *, curl_lock_data data, void * arg)
+{
+    static_cast<share *>(arg)->locks_[data].unlock();
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+url::url()
+    : url_(curl_url())
+{
+    if(url_ == nullptr)
+        throw ERROR("Failed to aquire CURLU handle");
+}
+
+url::url(const std::string& str)
+    : url()
+{
+    set(CURLUPART_URL, str);
+}
+
+url::url(const url& other)
+    : url_(curl_url_dup(other.url_))
+{
+    if(url_ == nullptr)
+        throw ERROR("Failed to aquire CURLU handle");
+}
+
+url::url(url&& other)
+    : url_(other.url_)
+{
+    other.url_ = nullptr;
+}
+
+url& url::operator = (const url& other)
+{
+    url tmp(other);
+    swap(tmp);
+    return *this;
+}
+
+url& url::operator = (url&& other)
+{
+    swap(other);
+    return *this;
+}
+
+url::~url()
+{
+    curl_url_cleanup(url_);
+}
+
+std::string url::get(CURLUPart part, unsigned int flags) const
+{
+    char * value = nullptr;
+    CURLUcode code = curl_url_get(url_, part, &value, flags);
+    if(code != CURLUE_OK)
+        return std::string();
+
+    std::string result(value);
+    curl_free(value);
+    return result;
+}
+
+void url::set(CURLUPart part, const std::string& value, unsigned int flags)
+{
+    CURLUcode code = curl_url_set(url_, part, value.c_str(), flags);
+    if(code != CURLUE_OK)
+        throw ERROR("Failed to set URL part");
+}
+
+url url::resolve(const std::string& ref) const
+{
+    // setting a relative URL on a full one makes libcurl resolve it
+    url result(*this);
+    result.set(CURLUPART_URL, ref);
+    return result;
+}
+
+std::string url::origin() const
+{
+    std::string result = get(CURLUPART_SCHEME);
+    result.append("://");
+    result.append(get(CURLUPART_HOST));
+    result.push_back(':');
+    result.append(get(CURLUPART_PORT, CURLU_DEFAULT_PORT));
+    return result;
+}
+
+std::string url::str() const
+{
+    return get(CURLUPART_URL);
+}
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 error::error(const char * msg)
     : buf_(strdup(msg))
@@ -274,7 +822,7 @@ error::error(const char * msg, const char * file, int line)
     buf_ = static_cast<char *>(malloc(size+1));
 
     // generate formatted error message
-    snprintf(buf_, size, fmt, file, line, msg);
+    snprintf(buf_, size+1, fmt, file, line, msg);
 }
 
 error::error(const char * msg, CURLcode code, const char * file, int line)
@@ -290,7 +838,23 @@ error::error(const char * msg, CURLcode code, const char * file, int line)
     buf_ = static_cast<char *>(malloc(size+1));
 
     // generate formatted error message
-    snprintf(buf_, size, fmt, file, line, msg, errstr);
+    snprintf(buf_, size+1, fmt, file, line, msg, errstr);
+}
+
+error::error(const char * msg, CURLMcode code, const char * file, int line)
+{
+    int size;
+    const char * errstr = curl_multi_strerror(code);
+    const char * fmt = "File: %s - Line: %d\n%s\n----------\n%s\n";
+
+    // find appropriate size for buffer
+    size = snprintf(nullptr, 0, fmt, file, line, msg, errstr);
+
+    // allocate buffer
+    buf_ = static_cast<char *>(malloc(size+1));
+
+    // generate formatted error message
+    snprintf(buf_, size+1, fmt, file, line, msg, errstr);
 }
 
 error::~error()
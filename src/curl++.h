@@ -26,6 +26,10 @@
 #include <string>
 #include <iosfwd>
 #include <map>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <mutex>
 #include <cstdio>
 
 namespace curl
@@ -47,6 +51,23 @@ private:
 };
 
 
+////////////////////////////////////////////////////////////////////////////////
+// write-callback target for easy::recv_into
+class sink
+{
+public:
+    virtual ~sink();
+
+    // called for every chunk libcurl delivers; `data` is only valid for the
+    // duration of the call
+    virtual void write(const char * data, size_t size) = 0;
+
+    // called once after the transfer completed successfully
+    virtual void finish();
+};
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // easy-handle wrapper
 class easy
@@ -61,19 +82,28 @@ public:
     // Use the `duplicate` method to get a copy created by curl_easy_duphandle.
     // (http://curl.haxx.se/libcurl/c/curl_easy_duphandle.html)
     easy(const easy& other) = delete;
-    easy(easy&& other) = default;
+    easy(easy&& other);
     easy& operator = (const easy& other) = delete;
-    easy& operator = (easy&& other) = default;
+    easy& operator = (easy&& other);
 
     // Generic methods to invoke curl_easy_setopt.
     // (http://curl.haxx.se/libcurl/c/curl_easy_setopt.html).
+    // Integers for CURLOPTTYPE_OFF_T options (the *_LARGE ones) are passed
+    // on as curl_off_t, which is `long` or `long long` depending on the
+    // platform; either overload takes a curl_off_t without truncating it.
     void set(CURLoption option, long value);
+    void set(CURLoption option, long long value);
     void set(CURLoption option, const std::string& value);
     template <typename T>
     void set(CURLoption option, const T * value);
     template <typename Ret, typename... Args>
     void set(CURLoption option, Ret (*value)(Args...));
 
+    // Generic method to invoke curl_easy_getinfo, e.g. `info<long>(CURLINFO_RESPONSE_CODE)`.
+    // (http://curl.haxx.se/libcurl/c/curl_easy_getinfo.html)
+    template <typename T>
+    T info(CURLINFO info) const;
+
     void add_cookie(const char * cookie);
     void add_cookie(const std::string& cookie);
     void add_cookie(const std::map<std::string, std::string> & cookies);
@@ -89,6 +119,7 @@ public:
     void recv_into(std::string&);
     void recv_into(std::ostream&);
     void recv_into(FILE *);
+    void recv_into(sink&);
 
     //
     std::string escape(const char * str, int len = 0);
@@ -118,6 +149,7 @@ private:
     static size_t recv_into_writefunc_string_(char *, size_t, size_t, std::string *);
     static size_t recv_into_writefunc_stream_(char *, size_t, size_t, std::ostream *);
     static size_t recv_into_writefunc_file_  (char *, size_t, size_t, FILE *);
+    static size_t recv_into_writefunc_sink_  (char *, size_t, size_t, void *);
 };
 
 inline void swap(easy& lhs, easy& rhs)
@@ -125,6 +157,92 @@ inline void swap(easy& lhs, easy& rhs)
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+// response-header collector
+//
+// Keeps the header block of the final response only; headers of redirects
+// and interim responses are dropped when the next status line arrives.
+class headers
+{
+public:
+    headers();
+
+    // set the header callback on `handle`; must outlive the transfer
+    void attach(easy& handle);
+
+    // value of the first header called `name` (case-insensitive), with
+    // surrounding whitespace removed; empty if there is none
+    std::string get(const char * name) const;
+    bool has(const char * name) const;
+
+    inline const std::string& raw() const
+    { return raw_; }
+
+    void clear();
+
+private:
+    std::string raw_;
+
+    size_t find_(const char * name) const;
+    static size_t callback_(char *, size_t, size_t, void *);
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// multi-handle wrapper
+class multi
+{
+public:
+    multi();
+    ~multi();
+
+    multi(const multi& other) = delete;
+    multi(multi&& other);
+    multi& operator = (const multi& other) = delete;
+    multi& operator = (multi&& other);
+
+    // Generic methods to invoke curl_multi_setopt.
+    // (http://curl.haxx.se/libcurl/c/curl_multi_setopt.html).
+    void set(CURLMoption option, long value);
+    template <typename T>
+    void set(CURLMoption option, T * value);
+    template <typename Ret, typename... Args>
+    void set(CURLMoption option, Ret (*value)(Args...));
+
+    // The easy handle has to stay alive and at the same address until it
+    // is removed again.
+    void add(easy& handle);
+    void remove(easy& handle);
+    void add(CURL * handle);
+    void remove(CURL * handle);
+
+    // returns the number of running transfers
+    int perform();
+    int socket_action(curl_socket_t socket, int ev_bitmask);
+
+    // curl_multi_poll without extra file descriptors, and its wakeup
+    void poll(int timeout_ms);
+    void wakeup();
+
+    // Fetch the next finished transfer; returns false if there is none.
+    bool next_done(CURL *& handle, CURLcode& result);
+
+    inline void swap(multi& other)
+    { std::swap(handle_, other.handle_); }
+
+    inline CURLM * handle()
+    { return handle_; }
+
+private:
+    CURLM * handle_;
+};
+
+inline void swap(multi& lhs, multi& rhs)
+{ lhs.swap(rhs); }
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // curl_slist wrapper
 
@@ -136,9 +254,9 @@ public:
     ~list();
 
     list(const list& other) = delete;
-    list(list&& other) = default;
+    list(list&& other);
     list& operator = (const list& other) = delete;
-    list& operator = (list&& other) = default;
+    list& operator = (list&& other);
 
     void append(const char *);
     void append(std::string&);
@@ -159,6 +277,160 @@ inline void swap(list& lhs, list& rhs)
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+// curl_mime wrapper
+//
+// None of the `add_*` methods except `add_data` copy the part's content;
+// file parts are streamed by libcurl while sending, buffer parts are read
+// straight from the borrowed memory and generator parts are pulled on demand.
+// Borrowed buffers and generators have to outlive every transfer the form is
+// attached to.
+class mime
+{
+public:
+    // Fills `buf` with at most `size` bytes and returns the number of bytes
+    // written, 0 on end of data, or CURL_READFUNC_ABORT/_PAUSE.
+    typedef std::function<size_t(char * buf, size_t size)> generator;
+
+    explicit mime(easy& handle);
+    ~mime();
+
+    mime(const mime& other) = delete;
+    mime(mime&& other);
+    mime& operator = (const mime& other) = delete;
+    mime& operator = (mime&& other);
+
+    // small in-memory field, copied by libcurl
+    mime& add_data(const char * name, const std::string& value,
+                   const char * type = nullptr);
+
+    // file part, read from `path` in chunks while the request is sent
+    mime& add_file(const char * name, const char * path,
+                   const char * type = nullptr, const char * filename = nullptr);
+
+    // borrowed memory span, not copied
+    mime& add_buffer(const char * name, const void * data, size_t size,
+                     const char * type = nullptr, const char * filename = nullptr);
+
+    // content produced by `gen`; a `size` of -1 means unknown and makes
+    // libcurl use chunked transfer encoding for the whole form
+    mime& add_generator(const char * name, generator gen, curl_off_t size = -1,
+                        const char * type = nullptr, const char * filename = nullptr);
+
+    // set CURLOPT_MIMEPOST on `handle`
+    void attach(easy& handle) const;
+
+    curl_mime * operator * () const;
+
+    inline void swap(mime& other)
+    {
+        std::swap(mime_, other.mime_);
+        std::swap(sources_, other.sources_);
+    }
+
+private:
+    struct source_
+    {
+        const char * data;
+        size_t size;
+        size_t pos;
+        generator gen;
+    };
+
+    curl_mime * mime_;
+    std::vector<std::unique_ptr<source_>> sources_;
+
+    curl_mimepart * add_part_(const char * name, const char * type,
+                              const char * filename);
+
+    static size_t read_buffer_(char *, size_t, size_t, void *);
+    static int seek_buffer_(void *, curl_off_t, int);
+    static size_t read_generator_(char *, size_t, size_t, void *);
+};
+
+inline void swap(mime& lhs, mime& rhs)
+{ lhs.swap(rhs); }
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// curl_share wrapper
+//
+// Locking is done internally with one mutex per lock_data type, so a share
+// object can be used by handles on different threads. The object must stay
+// at the same address while handles refer to it, hence it cannot be moved.
+class share
+{
+public:
+    share();
+    ~share();
+
+    share(const share& other) = delete;
+    share(share&& other) = delete;
+    share& operator = (const share& other) = delete;
+    share& operator = (share&& other) = delete;
+
+    // CURLSHOPT_SHARE/_UNSHARE, e.g. CURL_LOCK_DATA_SSL_SESSION
+    void add(curl_lock_data data);
+    void remove(curl_lock_data data);
+
+    // set CURLOPT_SHARE on `handle`
+    void attach(easy& handle) const;
+
+    CURLSH * operator * () const;
+
+private:
+    CURLSH * share_;
+    std::mutex locks_[CURL_LOCK_DATA_LAST];
+
+    static void lock_(CURL *, curl_lock_data, curl_lock_access, void *);
+    static void unlock_(CURL *, curl_lock_data, void *);
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// CURLU wrapper
+class url
+{
+public:
+    url();
+    explicit url(const std::string& str);
+    ~url();
+
+    url(const url& other);
+    url(url&& other);
+    url& operator = (const url& other);
+    url& operator = (url&& other);
+
+    // curl_url_get/_set for a single part; `get` returns an empty string for
+    // parts that are not present
+    std::string get(CURLUPart part, unsigned int flags = 0) const;
+    void set(CURLUPart part, const std::string& value, unsigned int flags = 0);
+
+    // resolve `ref` against this URL
+    url resolve(const std::string& ref) const;
+
+    // "scheme://host:port", used as connection-pool key
+    std::string origin() const;
+
+    std::string str() const;
+
+    inline CURLU * handle()
+    { return url_; }
+
+    inline void swap(url& other)
+    { std::swap(url_, other.url_); }
+
+private:
+    CURLU * url_;
+};
+
+inline void swap(url& lhs, url& rhs)
+{ lhs.swap(rhs); }
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // default exception class
 class error
@@ -168,6 +440,7 @@ public:
     explicit error(const char * msg);
     error(const char * msg, const char * file, int line);
     error(const char * msg, CURLcode code, const char * file, int line);
+    error(const char * msg, CURLMcode code, const char * file, int line);
     virtual ~error();
 
     virtual const char * what() const noexcept;
@@ -189,8 +462,10 @@ constexpr const char * firefox27 = "Mozilla/5.0 (X11; Linux x86_64; rv:27.0) Gec
 // Template method implementations
 
 #define CHECK(x) \
-    CURLcode code = (x); \
-    if(code != CURLE_OK) throw error(#x, code, __FILE__, __LINE__);
+    do { \
+        auto code = (x); \
+        if(code != decltype(code)(0)) throw error(#x, code, __FILE__, __LINE__); \
+    } while(0)
 
 template <typename T>
 void easy::set(CURLoption option, const T * value)
@@ -202,6 +477,24 @@ void easy::set(CURLoption option, Ret (*value)(Args...))
 {
     CHECK(curl_easy_setopt(handle_, option, value));
 }
+template <typename T>
+T easy::info(CURLINFO info) const
+{
+    T value = T();
+    CHECK(curl_easy_getinfo(handle_, info, &value));
+    return value;
+}
+
+template <typename T>
+void multi::set(CURLMoption option, T * value)
+{
+    CHECK(curl_multi_setopt(handle_, option, value));
+}
+template <typename Ret, typename... Args>
+void multi::set(CURLMoption option, Ret (*value)(Args...))
+{
+    CHECK(curl_multi_setopt(handle_, option, value));
+}
 
 #undef CHECK
 
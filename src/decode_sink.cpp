@@ -0,0 +1,245 @@
+/*
+ * decode_sink.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "decode_sink.h"
+#include <cstdint>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+namespace
+{
+    // table entries besides the digit values
+    const unsigned char space = 0x40;
+    const unsigned char pad = 0x41;
+    const unsigned char invalid = 0x80;
+
+    struct tables
+    {
+        unsigned char base64[256];
+        unsigned char base64url[256];
+        unsigned char hex[256];
+
+        tables()
+        {
+            const char * std64 =
+                "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+            const char * url64 =
+                "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+            for(int i = 0; i < 256; ++i)
+                base64[i] = base64url[i] = hex[i] = invalid;
+            for(int i = 0; i < 64; ++i)
+            {
+                base64[static_cast<unsigned char>(std64[i])] = i;
+                base64url[static_cast<unsigned char>(url64[i])] = i;
+            }
+            for(int i = 0; i < 10; ++i)
+                hex['0' + i] = i;
+            for(int i = 0; i < 6; ++i)
+                hex['a' + i] = hex['A' + i] = 10 + i;
+
+            for(unsigned char c : {' ', '\t', '\r', '\n', '\f', '\v'})
+                base64[c] = base64url[c] = hex[c] = space;
+            base64['='] = base64url['='] = pad;
+        }
+    };
+
+    const tables& lookup()
+    {
+        static const tables t;
+        return t;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+decode_sink::decode_sink(sink& next, encoding enc, size_t block_size)
+    : next_(next)
+    , enc_(enc)
+    , table_(enc == hex ? lookup().hex :
+             enc == base64url ? lookup().base64url : lookup().base64)
+    , block_size_(block_size < 64 ? 64 : block_size)
+    , count_(0)
+    , padded_(false)
+    , decoded_(0)
+{
+    out_.reserve(block_size_);
+}
+
+void decode_sink::write(const char * data, size_t size)
+{
+    const unsigned char * p = reinterpret_cast<const unsigned char *>(data);
+    if(enc_ == hex)
+        hex_(p, size);
+    else
+        base64_(p, size);
+}
+
+void decode_sink::finish()
+{
+    if(enc_ == hex ? count_ != 0 : count_ == 1)
+        throw ERROR("Encoded data ends in the middle of a byte");
+
+    // unpadded base64 tail
+    if(count_)
+        quad_();
+    flush_();
+    next_.finish();
+}
+
+void decode_sink::base64_(const unsigned char * p, size_t n)
+{
+    const unsigned char * end = p + n;
+    while(p < end)
+    {
+        // Fast path: whole quads of alphabet characters. The special table
+        // entries all have one of the two high bits set.
+        if(count_ == 0 && !padded_)
+        {
+            while(end - p >= 4)
+            {
+                unsigned int a = table_[p[0]], b = table_[p[1]];
+                unsigned int c = table_[p[2]], d = table_[p[3]];
+                if((a | b | c | d) & 0xC0)
+                    break;
+
+                uint32_t v = (a << 18) | (b << 12) | (c << 6) | d;
+                char bytes[3] = {
+                    static_cast<char>(v >> 16),
+                    static_cast<char>(v >> 8),
+                    static_cast<char>(v),
+                };
+                out_.append(bytes, 3);
+                p += 4;
+
+                if(out_.size() + 3 > block_size_)
+                    flush_();
+            }
+            if(p == end)
+                break;
+        }
+
+        // one character at a time around whitespace, padding and chunk ends
+        unsigned char v = table_[*p++];
+        if(v == space)
+            continue;
+        if(v == invalid)
+            throw ERROR("Invalid character in base64 data");
+
+        if(v == pad)
+        {
+            if(!padded_)
+            {
+                if(count_ < 2)
+                    throw ERROR("Misplaced base64 padding");
+                quad_();
+                padded_ = true;
+            }
+            continue;
+        }
+        if(padded_)
+            throw ERROR("Base64 data after padding");
+
+        pending_[count_++] = v;
+        if(count_ == 4)
+            quad_();
+    }
+
+    if(out_.size() >= block_size_ / 2)
+        flush_();
+}
+
+void decode_sink::hex_(const unsigned char * p, size_t n)
+{
+    const unsigned char * end = p + n;
+    while(p < end)
+    {
+        if(count_ == 0)
+        {
+            while(end - p >= 2)
+            {
+                unsigned int hi = table_[p[0]], lo = table_[p[1]];
+                if((hi | lo) & 0xC0)
+                    break;
+                out_.push_back(static_cast<char>((hi << 4) | lo));
+                p += 2;
+
+                if(out_.size() >= block_size_)
+                    flush_();
+            }
+            if(p == end)
+                break;
+        }
+
+        unsigned char v = table_[*p++];
+        if(v == space)
+            continue;
+        if(v & 0xC0)
+            throw ERROR("Invalid character in hex data");
+
+        pending_[count_++] = v;
+        if(count_ == 2)
+        {
+            if(out_.size() >= block_size_)
+                flush_();
+            out_.push_back(static_cast<char>((pending_[0] << 4) | pending_[1]));
+            count_ = 0;
+        }
+    }
+
+    if(out_.size() >= block_size_ / 2)
+        flush_();
+}
+
+void decode_sink::quad_()
+{
+    if(out_.size() + 3 > block_size_)
+        flush_();
+
+    // 2, 3 or 4 values give 1, 2 or 3 bytes
+    uint32_t v = 0;
+    for(size_t i = 0; i < 4; ++i)
+        v = (v << 6) | (i < count_ ? pending_[i] : 0);
+
+    char bytes[3] = {
+        static_cast<char>(v >> 16),
+        static_cast<char>(v >> 8),
+        static_cast<char>(v),
+    };
+    out_.append(bytes, count_ - 1);
+    count_ = 0;
+}
+
+void decode_sink::flush_()
+{
+    if(out_.empty())
+        return;
+    next_.write(out_.data(), out_.size());
+    decoded_ += out_.size();
+    out_.clear();
+}
+
+}
+
+#undef ERROR
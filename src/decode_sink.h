@@ -0,0 +1,79 @@
+/*
+ * decode_sink.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_DECODE_SINK_H
+#define CURLPP_DECODE_SINK_H
+
+#include "curl++.h"
+#include <string>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Sink decoding a base64 or hex body into `next` while it arrives.
+//
+// Line breaks and other whitespace are ignored, and base64 padding is
+// optional, so MIME-style wrapped and unpadded base64url input both work.
+// Characters outside the alphabet throw. Quads (pairs) split across
+// chunks are carried over; output is passed on in blocks of up to
+// `block_size` bytes.
+class decode_sink
+    : public sink
+{
+public:
+    enum encoding
+    {
+        base64,
+        base64url,      // '-' and '_' instead of '+' and '/'
+        hex,
+    };
+
+    explicit decode_sink(sink& next, encoding enc = base64, size_t block_size = 64 * 1024);
+
+    virtual void write(const char * data, size_t size);
+
+    // throws if the input ended in the middle of a byte
+    virtual void finish();
+
+    // decoded bytes passed on so far
+    inline uint64_t decoded() const
+    { return decoded_; }
+
+private:
+    sink& next_;
+    encoding enc_;
+    const unsigned char * table_;
+    size_t block_size_;
+    std::string out_;
+    unsigned char pending_[4];  // values of an incomplete quad or pair
+    size_t count_;
+    bool padded_;
+    uint64_t decoded_;
+
+    void base64_(const unsigned char * p, size_t n);
+    void hex_(const unsigned char * p, size_t n);
+    void quad_();
+    void flush_();
+};
+
+}
+
+#endif /* CURLPP_DECODE_SINK_H */
@@ -0,0 +1,463 @@
+/*
+ * dedup_store.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "dedup_store.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+struct chunk_store::header_
+{
+    char magic[8];
+    uint64_t capacity;      // slots, a power of two
+    uint64_t count;         // used slots
+    uint64_t pack_size;     // committed bytes in the pack file
+};
+
+struct chunk_store::entry_
+{
+    unsigned char hash[32];
+    uint64_t offset;
+    uint32_t size;
+    uint32_t used;
+};
+
+namespace
+{
+    const char index_magic[8] = {'c', 'u', 'r', 'l', 'i', 'd', 'x', '1'};
+    constexpr uint64_t initial_capacity = 1024;
+
+    int open_file(const std::string& path, int flags)
+    {
+        int fd = open(path.c_str(), flags | O_CREAT | O_CLOEXEC, 0644);
+        if(fd < 0)
+            throw ERROR("Failed to open chunk store file");
+        return fd;
+    }
+
+    void write_all(int fd, const void * data, size_t size, off_t offset)
+    {
+        const char * ptr = static_cast<const char *>(data);
+        while(size)
+        {
+            ssize_t n = pwrite(fd, ptr, size, offset);
+            if(n <= 0)
+                throw ERROR("Failed to write to chunk store");
+            ptr += n;
+            size -= n;
+            offset += n;
+        }
+    }
+
+    void read_all(int fd, void * data, size_t size, off_t offset)
+    {
+        char * ptr = static_cast<char *>(data);
+        while(size)
+        {
+            ssize_t n = pread(fd, ptr, size, offset);
+            if(n <= 0)
+                throw ERROR("Failed to read from chunk store");
+            ptr += n;
+            size -= n;
+            offset += n;
+        }
+    }
+
+    // gear table for the rolling hash, filled from splitmix64 so that chunk
+    // boundaries are the same in every process
+    struct gear_table
+    {
+        uint64_t values[256];
+
+        gear_table()
+        {
+            uint64_t x = 0x9e3779b97f4a7c15ull;
+            for(auto& v : values)
+            {
+                uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                v = z ^ (z >> 31);
+            }
+        }
+    };
+
+    const gear_table gear;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+chunk_store::chunk_store(const std::string& prefix)
+    : prefix_(prefix)
+    , pack_(open_file(prefix + ".pack", O_RDWR))
+    , index_(open_file(prefix + ".idx", O_RDWR))
+    , recipes_(open_file(prefix + ".rcp", O_RDWR | O_APPEND))
+    , header_map_(nullptr)
+    , map_size_(0)
+    , recipes_indexed_(0)
+{
+    struct stat st;
+    fstat(index_, &st);
+
+    if(st.st_size == 0)
+        header_map_ = map_index_(index_, initial_capacity, true, map_size_);
+    else
+    {
+        header_ hdr;
+        read_all(index_, &hdr, sizeof(hdr), 0);
+        if(memcmp(hdr.magic, index_magic, sizeof(index_magic)) != 0)
+            throw ERROR("Not a chunk store index");
+        header_map_ = map_index_(index_, hdr.capacity, false, map_size_);
+    }
+
+    index_recipes_();
+}
+
+chunk_store::~chunk_store()
+{
+    munmap(header_map_, map_size_);
+    close(recipes_);
+    close(index_);
+    close(pack_);
+}
+
+bool chunk_store::put(const std::string& hash, const char * data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(find_(hash))
+        return false;
+
+    if((header_map_->count + 1) * 2 > header_map_->capacity)
+        grow_();
+
+    // data first, so the index never points past the committed pack size
+    uint64_t offset = header_map_->pack_size;
+    write_all(pack_, data, size, offset);
+
+    entry_ * e = slot_(table_(header_map_), header_map_->capacity, hash);
+    memcpy(e->hash, hash.data(), sizeof(e->hash));
+    e->offset = offset;
+    e->size = size;
+    e->used = 1;
+    header_map_->pack_size += size;
+    ++header_map_->count;
+    return true;
+}
+
+bool chunk_store::contains(const std::string& hash) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return find_(hash) != nullptr;
+}
+
+std::string chunk_store::get(const std::string& hash) const
+{
+    uint64_t offset;
+    uint32_t size;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const entry_ * e = find_(hash);
+        if(e == nullptr)
+            throw ERROR("Chunk not found in store");
+        offset = e->offset;
+        size = e->size;
+    }
+
+    std::string data(size, '\0');
+    if(size)
+        read_all(pack_, &data[0], size, offset);
+    return data;
+}
+
+void chunk_store::add_recipe(const std::string& key, const recipe& chunks)
+{
+    // u32 key length, key, u32 chunk count, 32 bytes per chunk
+    std::string record;
+    uint32_t len = key.size();
+    uint32_t count = chunks.size();
+    record.reserve(8 + key.size() + 32 * chunks.size());
+    record.append(reinterpret_cast<const char *>(&len), sizeof(len));
+    record.append(key);
+    record.append(reinterpret_cast<const char *>(&count), sizeof(count));
+    for(auto&& hash : chunks)
+        record.append(hash, 0, 32);
+
+    // a single O_APPEND write keeps records from interleaving
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(::write(recipes_, record.data(), record.size()) != static_cast<ssize_t>(record.size()))
+        throw ERROR("Failed to write recipe");
+}
+
+bool chunk_store::find_recipe(const std::string& key, recipe& chunks) const
+{
+    recipe_ref_ ref;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        index_recipes_();
+        auto it = recipe_index_.find(key);
+        if(it == recipe_index_.end())
+            return false;
+        ref = it->second;
+    }
+
+    std::string hashes(32 * size_t(ref.count), '\0');
+    if(ref.count)
+        read_all(recipes_, &hashes[0], hashes.size(), ref.offset);
+    chunks.clear();
+    for(uint32_t i = 0; i < ref.count; ++i)
+        chunks.push_back(hashes.substr(32 * i, 32));
+    return true;
+}
+
+void chunk_store::restore(const recipe& chunks, sink& out) const
+{
+    for(auto&& hash : chunks)
+    {
+        std::string data = get(hash);
+        out.write(data.data(), data.size());
+    }
+    out.finish();
+}
+
+size_t chunk_store::chunks() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return header_map_->count;
+}
+
+uint64_t chunk_store::pack_size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return header_map_->pack_size;
+}
+
+chunk_store::header_ * chunk_store::map_index_(int fd, uint64_t capacity,
+                                                bool create, size_t& size)
+{
+    size = sizeof(header_) + capacity * sizeof(entry_);
+    if(create && ftruncate(fd, size) != 0)
+        throw ERROR("Failed to size chunk store index");
+
+    void * addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(addr == MAP_FAILED)
+        throw ERROR("Failed to map chunk store index");
+
+    header_ * header = static_cast<header_ *>(addr);
+    if(create)
+    {
+        // ftruncate zero-fills, so all slots start out unused
+        memcpy(header->magic, index_magic, sizeof(index_magic));
+        header->capacity = capacity;
+        header->count = 0;
+        header->pack_size = 0;
+    }
+    return header;
+}
+
+void chunk_store::grow_()
+{
+    // build the larger table in a new file and swap it in with rename, so
+    // an interrupted resize leaves the old index intact; the members are
+    // only touched once the new index is in place
+    std::string tmp_path = prefix_ + ".idx.tmp";
+    uint64_t old_capacity = header_map_->capacity;
+    int fd = open_file(tmp_path, O_RDWR | O_TRUNC);
+    header_ * map = nullptr;
+    size_t size = 0;
+
+    try
+    {
+        map = map_index_(fd, old_capacity * 2, true, size);
+        map->pack_size = header_map_->pack_size;
+
+        entry_ * old_table = table_(header_map_);
+        entry_ * new_table = table_(map);
+        for(uint64_t i = 0; i < old_capacity; ++i)
+        {
+            if(!old_table[i].used)
+                continue;
+            std::string hash(reinterpret_cast<char *>(old_table[i].hash), 32);
+            *slot_(new_table, map->capacity, hash) = old_table[i];
+            ++map->count;
+        }
+
+        if(rename(tmp_path.c_str(), (prefix_ + ".idx").c_str()) != 0)
+            throw ERROR("Failed to replace chunk store index");
+    }
+    catch(...)
+    {
+        if(map)
+            munmap(map, size);
+        close(fd);
+        unlink(tmp_path.c_str());
+        throw;
+    }
+
+    munmap(header_map_, map_size_);
+    close(index_);
+    index_ = fd;
+    header_map_ = map;
+    map_size_ = size;
+}
+
+void chunk_store::index_recipes_() const
+{
+    // index the records appended since the last call; a record still being
+    // written is picked up next time
+    struct stat st;
+    if(fstat(recipes_, &st) != 0)
+        throw ERROR("Failed to read recipe log");
+
+    std::string buf;        // log data from `recipes_indexed_` on
+    size_t used = 0;        // bytes of `buf` already indexed
+    off_t read_to = recipes_indexed_;
+    for(;;)
+    {
+        for(;;)
+        {
+            size_t left = buf.size() - used;
+            uint32_t len, count;
+            if(left < 8)
+                break;
+            memcpy(&len, &buf[used], sizeof(len));
+            if(left < size_t(8) + len)
+                break;
+            memcpy(&count, &buf[used + 4 + len], sizeof(count));
+            size_t total = 8 + size_t(len) + 32 * size_t(count);
+            if(left < total)
+                break;
+
+            // later records replace earlier ones for the same key
+            recipe_index_[buf.substr(used + 4, len)] =
+                recipe_ref_{recipes_indexed_ + 8 + off_t(len), count};
+            recipes_indexed_ += total;
+            used += total;
+        }
+
+        if(read_to >= st.st_size)
+            return;
+
+        buf.erase(0, used);
+        used = 0;
+        size_t n = std::min<off_t>(1024 * 1024, st.st_size - read_to);
+        size_t have = buf.size();
+        buf.resize(have + n);
+        read_all(recipes_, &buf[have], n, read_to);
+        read_to += n;
+    }
+}
+
+const chunk_store::entry_ * chunk_store::find_(const std::string& hash) const
+{
+    entry_ * e = slot_(table_(header_map_), header_map_->capacity, hash);
+    return e->used ? e : nullptr;
+}
+
+chunk_store::entry_ * chunk_store::table_(header_ * header)
+{
+    // the slots follow the header directly
+    return reinterpret_cast<entry_ *>(header + 1);
+}
+
+chunk_store::entry_ * chunk_store::slot_(entry_ * table, uint64_t capacity,
+                                         const std::string& hash) const
+{
+    // the hash is uniformly distributed already; use its first 8 bytes
+    if(hash.size() != 32)
+        throw ERROR("Chunk hash must be a raw SHA-256");
+
+    uint64_t h;
+    memcpy(&h, hash.data(), sizeof(h));
+    for(uint64_t i = h & (capacity - 1); ; i = (i + 1) & (capacity - 1))
+    {
+        entry_ * e = &table[i];
+        if(!e->used || memcmp(e->hash, hash.data(), 32) == 0)
+            return e;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+dedup_sink::dedup_sink(chunk_store& store, std::string key,
+                       size_t min_chunk, size_t avg_chunk, size_t max_chunk)
+    : store_(store)
+    , key_(std::move(key))
+    , min_(min_chunk)
+    , max_(max_chunk)
+    , mask_(0)
+    , hash_(0)
+    , stored_(0)
+{
+    // The low bits of a gear hash only depend on the last few bytes, so the
+    // boundary test uses the top log2(avg_chunk) bits.
+    int bits = 0;
+    while((size_t(1) << (bits + 1)) <= avg_chunk)
+        ++bits;
+    mask_ = bits ? ~uint64_t(0) << (64 - bits) : 0;
+    buffer_.reserve(max_);
+}
+
+void dedup_sink::write(const char * data, size_t size)
+{
+    size_t start = 0;
+    for(size_t i = 0; i < size; ++i)
+    {
+        hash_ = (hash_ << 1) + gear.values[static_cast<unsigned char>(data[i])];
+
+        size_t len = buffer_.size() + (i - start + 1);
+        if((len >= min_ && (hash_ & mask_) == 0) || len >= max_)
+        {
+            buffer_.append(data + start, i - start + 1);
+            start = i + 1;
+            cut_();
+        }
+    }
+    buffer_.append(data + start, size - start);
+}
+
+void dedup_sink::finish()
+{
+    if(!buffer_.empty())
+        cut_();
+    store_.add_recipe(key_, recipe_);
+}
+
+void dedup_sink::cut_()
+{
+    std::string hash = digest::of(digest::sha256, buffer_.data(), buffer_.size());
+    if(store_.put(hash, buffer_.data(), buffer_.size()))
+        stored_ += buffer_.size();
+    recipe_.push_back(std::move(hash));
+    buffer_.clear();
+    hash_ = 0;
+}
+
+}
+
+#undef ERROR
@@ -0,0 +1,154 @@
+/*
+ * dedup_store.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_DEDUP_STORE_H
+#define CURLPP_DEDUP_STORE_H
+
+#include "digest.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Content-addressed chunk store (POSIX).
+//
+// Chunks are appended to `<prefix>.pack` and found through `<prefix>.idx`,
+// an open-addressing hash table keyed by the chunk's SHA-256 that lives in
+// a memory-mapped file and doubles in size when half full. Responses are
+// recorded in `<prefix>.rcp` as the list of their chunks' hashes; an
+// in-memory table from key to latest recipe is built from that log when the
+// store is opened and kept up to date as it grows.
+//
+// All methods may be called from several threads.
+class chunk_store
+{
+public:
+    typedef std::vector<std::string> recipe;   // raw SHA-256 per chunk
+
+    explicit chunk_store(const std::string& prefix);
+    ~chunk_store();
+
+    chunk_store(const chunk_store& other) = delete;
+    chunk_store& operator = (const chunk_store& other) = delete;
+
+    // store a chunk unless one with the same hash exists; returns true if
+    // the chunk was new
+    bool put(const std::string& hash, const char * data, size_t size);
+
+    bool contains(const std::string& hash) const;
+
+    // read a stored chunk
+    std::string get(const std::string& hash) const;
+
+    // append `key` and its chunk list to the recipe log
+    void add_recipe(const std::string& key, const recipe& chunks);
+
+    // look up the latest recipe recorded for `key`
+    bool find_recipe(const std::string& key, recipe& chunks) const;
+
+    // write a recorded response to `out`
+    void restore(const recipe& chunks, sink& out) const;
+
+    size_t chunks() const;
+    uint64_t pack_size() const;
+
+private:
+    struct header_;
+    struct entry_;
+
+    // where the chunk hashes of a recipe start in the log
+    struct recipe_ref_
+    {
+        off_t offset;
+        uint32_t count;
+    };
+
+    mutable std::mutex mutex_;
+    std::string prefix_;
+    int pack_;
+    int index_;
+    int recipes_;
+    header_ * header_map_;
+    size_t map_size_;
+    mutable std::unordered_map<std::string, recipe_ref_> recipe_index_;
+    mutable off_t recipes_indexed_;     // log bytes covered by recipe_index_
+
+    static header_ * map_index_(int fd, uint64_t capacity, bool create, size_t& size);
+    void grow_();
+    void index_recipes_() const;
+    const entry_ * find_(const std::string& hash) const;
+    entry_ * slot_(entry_ * table, uint64_t capacity, const std::string& hash) const;
+
+    static entry_ * table_(header_ * header);
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Sink splitting a response into content-defined chunks and storing each
+// distinct chunk once.
+//
+// Chunk boundaries come from a Gear rolling hash over the content, so an
+// insertion early in a document only changes the chunks around it and
+// near-duplicate documents share most of their chunks. At most one chunk
+// (`max_chunk` bytes) is buffered.
+class dedup_sink
+    : public sink
+{
+public:
+    dedup_sink(chunk_store& store, std::string key,
+               size_t min_chunk = 2048, size_t avg_chunk = 8192,
+               size_t max_chunk = 65536);
+
+    virtual void write(const char * data, size_t size);
+
+    // store the last chunk and record the recipe under the key
+    virtual void finish();
+
+    inline const chunk_store::recipe& chunks() const
+    { return recipe_; }
+
+    // bytes that were new to the store
+    inline uint64_t stored() const
+    { return stored_; }
+
+private:
+    chunk_store& store_;
+    std::string key_;
+    size_t min_;
+    size_t max_;
+    uint64_t mask_;
+    uint64_t hash_;
+    std::string buffer_;
+    chunk_store::recipe recipe_;
+    uint64_t stored_;
+
+    void cut_();
+};
+
+}
+
+#endif /* CURLPP_DEDUP_STORE_H */
@@ -0,0 +1,148 @@
+/*
+ * digest.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "digest.h"
+#include <openssl/evp.h>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+digest::digest(algorithm algo)
+    : ctx_(EVP_MD_CTX_new())
+    , algo_(algo)
+{
+    if(ctx_ == nullptr)
+        throw ERROR("Failed to allocate digest context");
+    init_();
+}
+
+digest::~digest()
+{
+    EVP_MD_CTX_free(ctx_);
+}
+
+void digest::update(const void * data, size_t size)
+{
+    if(EVP_DigestUpdate(ctx_, data, size) != 1)
+        throw ERROR("Failed to update digest");
+}
+
+std::string digest::finish()
+{
+    unsigned char buf[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+
+    if(EVP_DigestFinal_ex(ctx_, buf, &len) != 1)
+        throw ERROR("Failed to finish digest");
+    init_();
+    return std::string(reinterpret_cast<char *>(buf), len);
+}
+
+std::string digest::of(algorithm algo, const void * data, size_t size)
+{
+    digest d(algo);
+    d.update(data, size);
+    return d.finish();
+}
+
+std::string digest::hex(const std::string& raw)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string result;
+    result.reserve(raw.size() * 2);
+    for(unsigned char c : raw)
+    {
+        result.push_back(digits[c >> 4]);
+        result.push_back(digits[c & 15]);
+    }
+    return result;
+}
+
+std::string digest::base32(const std::string& raw)
+{
+    // RFC 4648 alphabet, as used for WARC payload digests
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+    std::string result;
+    unsigned int buffer = 0;
+    int bits = 0;
+
+    for(unsigned char c : raw)
+    {
+        buffer = (buffer << 8) | c;
+        bits += 8;
+        while(bits >= 5)
+        {
+            result.push_back(digits[(buffer >> (bits - 5)) & 31]);
+            bits -= 5;
+        }
+    }
+    if(bits > 0)
+        result.push_back(digits[(buffer << (5 - bits)) & 31]);
+    while(result.size() % 8)
+        result.push_back('=');
+    return result;
+}
+
+std::string digest::base64(const std::string& raw)
+{
+    std::string result(4 * ((raw.size() + 2) / 3) + 1, '\0');
+    int len = EVP_EncodeBlock(reinterpret_cast<unsigned char *>(&result[0]),
+                              reinterpret_cast<const unsigned char *>(raw.data()),
+                              raw.size());
+    result.resize(len);
+    return result;
+}
+
+void digest::init_()
+{
+    const EVP_MD * md = algo_ == sha1 ? EVP_sha1() : EVP_sha256();
+    if(EVP_DigestInit_ex(ctx_, md, nullptr) != 1)
+        throw ERROR("Failed to initialize digest");
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+digest_sink::digest_sink(digest::algorithm algo, sink * next)
+    : digest_(algo)
+    , next_(next)
+{}
+
+void digest_sink::write(const char * data, size_t size)
+{
+    digest_.update(data, size);
+    if(next_)
+        next_->write(data, size);
+}
+
+void digest_sink::finish()
+{
+    value_ = digest_.finish();
+    if(next_)
+        next_->finish();
+}
+
+}
+
+#undef ERROR
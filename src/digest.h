@@ -0,0 +1,95 @@
+/*
+ * digest.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_DIGEST_H
+#define CURLPP_DIGEST_H
+
+#include "curl++.h"
+#include <string>
+
+typedef struct evp_md_ctx_st EVP_MD_CTX;
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Incremental message digest on top of OpenSSL's EVP interface, which picks
+// the fastest implementation for the CPU (SHA-NI, AVX2, ...).
+class digest
+{
+public:
+    enum algorithm
+    {
+        sha1,
+        sha256,
+    };
+
+    explicit digest(algorithm algo = sha256);
+    ~digest();
+
+    digest(const digest& other) = delete;
+    digest& operator = (const digest& other) = delete;
+
+    void update(const void * data, size_t size);
+
+    // raw digest bytes; the object starts over afterwards
+    std::string finish();
+
+    // one-shot helper
+    static std::string of(algorithm algo, const void * data, size_t size);
+
+    static std::string hex(const std::string& raw);
+    static std::string base32(const std::string& raw);
+    static std::string base64(const std::string& raw);
+
+private:
+    EVP_MD_CTX * ctx_;
+    algorithm algo_;
+
+    void init_();
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// sink computing a digest of everything passing through it; forwards the
+// data to `next` if given
+class digest_sink
+    : public sink
+{
+public:
+    explicit digest_sink(digest::algorithm algo = digest::sha256, sink * next = nullptr);
+
+    virtual void write(const char * data, size_t size);
+    virtual void finish();
+
+    // raw digest, available after finish()
+    inline const std::string& value() const
+    { return value_; }
+
+private:
+    digest digest_;
+    sink * next_;
+    std::string value_;
+};
+
+}
+
+#endif /* CURLPP_DIGEST_H */
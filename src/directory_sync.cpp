@@ -0,0 +1,566 @@
+/*
+ * directory_sync.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "directory_sync.h"
+#include "digest.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <map>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+namespace
+{
+    const char state_name[] = ".curlsync";
+    const char temp_marker[] = ".curlsync-";
+
+    // create the directories leading up to `path`
+    void make_parents(const std::string& path)
+    {
+        for(size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1))
+        {
+            std::string dir = path.substr(0, pos);
+            if(mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+                throw ERROR("Failed to create directory");
+        }
+    }
+
+    // relative, without empty, "." or ".." components
+    bool safe_path(const std::string& path)
+    {
+        if(path.empty() || path[0] == '/' || path == state_name)
+            return false;
+
+        size_t start = 0;
+        for(;;)
+        {
+            size_t end = path.find('/', start);
+            std::string part = path.substr(start, end - start);
+            if(part.empty() || part == "." || part == ".."
+                    || part.find(temp_marker) != std::string::npos)
+                return false;
+            if(end == std::string::npos)
+                return true;
+            start = end + 1;
+        }
+    }
+
+    // the file an atomic_file temporary `path` stands in for, i.e. `path`
+    // without the suffix mkstemp made of `temp_marker` and six characters;
+    // empty if it is not such a file
+    std::string temp_stem(const std::string& path)
+    {
+        size_t marker = sizeof(temp_marker) - 1;
+        size_t name = path.rfind('/') + 1;      // 0 without a directory
+        if(path.size() < name + marker + 7)
+            return std::string();
+        size_t pos = path.size() - marker - 6;
+        if(path.compare(pos, marker, temp_marker) != 0)
+            return std::string();
+        return path.substr(0, pos);
+    }
+
+    std::string encode_path(const std::string& path)
+    {
+        static const char hex[] = "0123456789ABCDEF";
+        std::string out;
+        out.reserve(path.size());
+        for(unsigned char c : path)
+        {
+            if(isalnum(c) || strchr("-._~/", c))
+                out += static_cast<char>(c);
+            else
+            {
+                out += '%';
+                out += hex[c >> 4];
+                out += hex[c & 15];
+            }
+        }
+        return out;
+    }
+
+    int64_t mtime_of(const struct stat& st)
+    {
+        return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    }
+
+    // what the manifest says about the version of a file
+    std::string version_of(const sync_entry& e)
+    {
+        if(!e.sha256.empty())
+            return "sha256:" + e.sha256;
+        if(!e.etag.empty())
+            return "etag:" + e.etag;
+        if(e.modified >= 0)
+            return "mtime:" + std::to_string(e.modified) + "/" + std::to_string(e.size);
+        return std::string();
+    }
+
+    std::vector<std::string> split_tabs(const std::string& line)
+    {
+        std::vector<std::string> fields;
+        size_t start = 0;
+        for(;;)
+        {
+            size_t end = line.find('\t', start);
+            fields.push_back(line.substr(start, end - start));
+            if(end == std::string::npos)
+                return fields;
+            start = end + 1;
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+atomic_file::atomic_file(const std::string& path)
+    : path_(path)
+    , temp_(path + temp_marker + "XXXXXX")
+    , file_(nullptr)
+    , size_(0)
+{
+    int fd = mkstemp(&temp_[0]);
+    if(fd < 0)
+        throw ERROR("Failed to create temporary file");
+    fchmod(fd, 0644);
+
+    file_ = fdopen(fd, "wb");
+    if(file_ == nullptr)
+    {
+        close(fd);
+        unlink(temp_.c_str());
+        throw ERROR("Failed to open temporary file");
+    }
+}
+
+atomic_file::~atomic_file()
+{
+    if(file_)
+        fclose(file_);
+    if(!temp_.empty())
+        unlink(temp_.c_str());
+}
+
+void atomic_file::write(const char * data, size_t size)
+{
+    if(file_ == nullptr)
+        throw ERROR("Write to finished file");
+    if(fwrite(data, 1, size, file_) != size)
+        throw ERROR("Failed to write temporary file");
+    size_ += size;
+}
+
+void atomic_file::finish()
+{
+    if(file_ == nullptr)
+        return;
+
+    // the data has to be on disk before the rename makes it visible
+    bool ok = fflush(file_) == 0 && fsync(fileno(file_)) == 0;
+    ok = fclose(file_) == 0 && ok;
+    file_ = nullptr;
+    if(!ok)
+        throw ERROR("Failed to flush temporary file");
+}
+
+void atomic_file::commit()
+{
+    finish();
+    if(temp_.empty())
+        return;
+    if(rename(temp_.c_str(), path_.c_str()) != 0)
+        throw ERROR("Failed to rename temporary file");
+    temp_.clear();
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// a file on disk and what was recorded about it
+struct directory_sync::local_
+{
+    bool present = false;       // exists on disk
+    curl_off_t size = -1;
+    int64_t mtime = -1;         // ns
+
+    bool recorded = false;      // listed in the state file
+    curl_off_t recorded_size = -1;
+    int64_t recorded_mtime = -1;
+    std::string etag;           // validators of the response it came from
+    time_t last_modified = -1;
+    std::string version;        // version_of() the manifest entry
+
+    // unchanged since it was fetched
+    inline bool intact() const
+    { return present && recorded && size == recorded_size && mtime == recorded_mtime; }
+};
+
+struct directory_sync::fetch_
+{
+    const sync_entry * entry;
+    std::string target;
+    local_ * local;
+    bool conditional;                       // may be answered with 304
+    std::unique_ptr<atomic_file> file;      // created with the first byte
+    std::unique_ptr<digest_sink> hash;
+    list request;
+    headers response;
+    std::exception_ptr exc;
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+directory_sync::directory_sync(pool& handles, const std::string& directory)
+    : directory_sync(handles, directory, options())
+{}
+
+directory_sync::directory_sync(pool& handles, const std::string& directory, options opts)
+    : handles_(handles)
+    , directory_(directory)
+    , opts_(opts)
+{
+    while(directory_.size() > 1 && directory_.back() == '/')
+        directory_.pop_back();
+}
+
+directory_sync::report directory_sync::run(const std::vector<sync_entry>& manifest)
+{
+    // an empty manifest is more likely a failed download than a request to
+    // delete everything
+    if(manifest.empty() && opts_.remove_stale && !opts_.allow_empty)
+        throw ERROR("Empty manifest");
+
+    report rep;
+    std::map<std::string, local_> files;
+    make_parents(directory_ + "/");
+
+    // what is on disk, and leftovers of interrupted runs
+    std::vector<std::string> temps;
+    std::vector<std::string> pending(1, std::string());
+    while(!pending.empty())
+    {
+        std::string rel = pending.back();
+        pending.pop_back();
+        std::string dir = rel.empty() ? directory_ : directory_ + "/" + rel;
+
+        DIR * d = opendir(dir.c_str());
+        if(d == nullptr)
+            throw ERROR("Failed to read sync directory");
+        while(struct dirent * e = readdir(d))
+        {
+            std::string name = e->d_name;
+            if(name == "." || name == ".." || (rel.empty() && name == state_name))
+                continue;
+
+            std::string path = rel.empty() ? name : rel + "/" + name;
+            struct stat st;
+            if(lstat((directory_ + "/" + path).c_str(), &st) != 0)
+                continue;
+            if(S_ISDIR(st.st_mode))
+                pending.push_back(path);
+            else if(S_ISREG(st.st_mode) && !temp_stem(path).empty())
+                temps.push_back(path);
+            else if(S_ISREG(st.st_mode))
+            {
+                local_& l = files[path];
+                l.present = true;
+                l.size = st.st_size;
+                l.mtime = mtime_of(st);
+            }
+        }
+        closedir(d);
+    }
+
+    // what was fetched before:
+    // path, size, mtime, etag, last-modified, version
+    std::string state_path = directory_ + "/" + state_name;
+    if(FILE * in = fopen(state_path.c_str(), "re"))
+    {
+        std::string line;
+        int c;
+        while((c = fgetc(in)) != EOF)
+        {
+            if(c != '\n')
+            {
+                line += static_cast<char>(c);
+                continue;
+            }
+            std::vector<std::string> f = split_tabs(line);
+            line.clear();
+            if(f.size() != 6)
+                continue;
+
+            local_& l = files[f[0]];
+            l.recorded = true;
+            l.recorded_size = strtoll(f[1].c_str(), nullptr, 10);
+            l.recorded_mtime = strtoll(f[2].c_str(), nullptr, 10);
+            l.etag = f[3];
+            l.last_modified = strtoll(f[4].c_str(), nullptr, 10);
+            l.version = f[5];
+        }
+        fclose(in);
+    }
+
+    // fetch what is missing or may have changed
+    executor ex(handles_, opts_.max_active);
+    std::map<std::string, const sync_entry *> wanted;
+    std::vector<std::unique_ptr<fetch_>> fetches;
+
+    for(auto&& e : manifest)
+    {
+        if(!safe_path(e.path))
+        {
+            rep.failed.emplace_back(e.path, "Unsafe path");
+            continue;
+        }
+        if(!wanted.emplace(e.path, &e).second)
+        {
+            rep.failed.emplace_back(e.path, "Duplicate path");
+            continue;
+        }
+
+        local_& l = files[e.path];
+        std::string version = version_of(e);
+        if(l.intact() && !version.empty() && version == l.version)
+        {
+            ++rep.unchanged;
+            continue;
+        }
+
+        // only a copy known to be what the validators describe may be kept
+        // on a 304, and not when the manifest names different content: the
+        // server may still hand out the old validators for the new file
+        bool conditional = l.intact() && (e.sha256.empty() || version == l.version);
+
+        fetches.emplace_back(new fetch_{&e, directory_ + "/" + e.path, &l, conditional,
+                                        nullptr, nullptr, list(), headers(), nullptr});
+        fetch_ * f = fetches.back().get();
+
+        ex.add(e.address,
+            [this, f](easy& handle) {
+                handle.set(CURLOPT_WRITEFUNCTION, directory_sync::write_);
+                handle.set(CURLOPT_WRITEDATA, static_cast<void *>(f));
+                handle.set(CURLOPT_FOLLOWLOCATION, 1L);
+                handle.set(CURLOPT_FAILONERROR, 1L);
+                handle.set(CURLOPT_FILETIME, 1L);
+                if(opts_.timeout)
+                    handle.set(CURLOPT_TIMEOUT_MS, opts_.timeout);
+                f->response.attach(handle);
+
+                if(f->conditional)
+                {
+                    if(!f->local->etag.empty())
+                    {
+                        f->request += ("If-None-Match: " + f->local->etag).c_str();
+                        handle.set(CURLOPT_HTTPHEADER, *f->request);
+                    }
+                    else if(f->local->last_modified >= 0)
+                    {
+                        handle.set(CURLOPT_TIMECONDITION, static_cast<long>(CURL_TIMECOND_IFMODSINCE));
+                        handle.set(CURLOPT_TIMEVALUE_LARGE, static_cast<curl_off_t>(f->local->last_modified));
+                    }
+                }
+            },
+            [&rep, f](easy& handle, CURLcode result) {
+                const sync_entry& e = *f->entry;
+                local_& l = *f->local;
+                long status = handle.info<long>(CURLINFO_RESPONSE_CODE);
+
+                if(f->conditional && result == CURLE_OK
+                        && (status == 304 || handle.info<long>(CURLINFO_CONDITION_UNMET)))
+                {
+                    l.version = version_of(e);
+                    ++rep.not_modified;
+                    return;
+                }
+
+                try
+                {
+                    if(f->exc)
+                        std::rethrow_exception(f->exc);
+                    if(result != CURLE_OK)
+                        throw error(curl_easy_strerror(result));
+                    if(status == 304)
+                        throw error("Unexpected 304 response");
+
+                    // an empty body never called the write callback
+                    if(!f->file)
+                        directory_sync::write_(nullptr, 0, 0, f);
+                    f->hash->finish();
+
+                    if(e.size >= 0 && f->file->size() != e.size)
+                        throw error("Size does not match the manifest");
+                    if(!e.sha256.empty() && digest::hex(f->hash->value()) != e.sha256)
+                        throw error("SHA-256 does not match the manifest");
+                    f->file->commit();
+
+                    struct stat st;
+                    if(stat(f->target.c_str(), &st) != 0)
+                        throw error("Fetched file disappeared");
+                    l.present = l.recorded = true;
+                    l.size = l.recorded_size = st.st_size;
+                    l.mtime = l.recorded_mtime = mtime_of(st);
+                    l.etag = f->response.get("ETag");
+                    l.last_modified = static_cast<time_t>(handle.info<curl_off_t>(CURLINFO_FILETIME_T));
+                    l.version = version_of(e);
+                    rep.bytes += st.st_size;
+                    ++rep.fetched;
+                }
+                catch(const std::exception& exc)
+                {
+                    rep.failed.emplace_back(e.path, exc.what());
+                }
+                f->file.reset();
+                f->hash.reset();
+            });
+    }
+
+    // temporary files of earlier runs go away, but only those next to files
+    // this sync is responsible for
+    for(auto&& path : temps)
+    {
+        std::string stem = temp_stem(path);
+        auto it = files.find(stem);
+        if(wanted.count(stem) || (it != files.end() && it->second.recorded))
+            unlink((directory_ + "/" + path).c_str());
+    }
+
+    ex.run();
+    fetches.clear();
+
+    // remove what the manifest no longer lists; files the sync did not
+    // write itself are left alone
+    if(opts_.remove_stale)
+        for(auto it = files.begin(); it != files.end(); )
+        {
+            if(wanted.count(it->first) || !it->second.recorded)
+            {
+                ++it;
+                continue;
+            }
+
+            std::string path = directory_ + "/" + it->first;
+            if(it->second.present && unlink(path.c_str()) != 0 && errno != ENOENT)
+            {
+                rep.failed.emplace_back(it->first, "Failed to delete stale file");
+                ++it;
+                continue;
+            }
+            if(it->second.present)
+                ++rep.deleted;
+
+            // and directories left empty by it
+            for(size_t pos = path.rfind('/'); pos > directory_.size(); pos = path.rfind('/'))
+            {
+                path.resize(pos);
+                if(rmdir(path.c_str()) != 0)
+                    break;
+            }
+            it = files.erase(it);
+        }
+
+    atomic_file state(state_path);
+    for(auto&& f : files)
+    {
+        const local_& l = f.second;
+        if(!l.recorded || !l.present)
+            continue;
+        std::string line = f.first + "\t" + std::to_string(l.recorded_size) + "\t"
+            + std::to_string(l.recorded_mtime) + "\t" + l.etag + "\t"
+            + std::to_string(static_cast<long long>(l.last_modified)) + "\t" + l.version + "\n";
+        state.write(line.data(), line.size());
+    }
+    state.commit();
+
+    return rep;
+}
+
+std::vector<sync_entry> directory_sync::parse_manifest(const std::string& text,
+                                                       const std::string& base)
+{
+    std::vector<sync_entry> entries;
+    url root(base);
+
+    size_t start = 0;
+    while(start < text.size())
+    {
+        size_t end = text.find('\n', start);
+        if(end == std::string::npos)
+            end = text.size();
+        std::string line = text.substr(start, end - start);
+        start = end + 1;
+
+        if(!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if(line.empty() || line[0] == '#')
+            continue;
+
+        std::vector<std::string> f = split_tabs(line);
+        sync_entry e;
+        e.path = f[0];
+        e.address = root.resolve(encode_path(e.path)).str();
+        if(f.size() > 1 && f[1] != "-" && !f[1].empty())
+            e.size = strtoll(f[1].c_str(), nullptr, 10);
+        if(f.size() > 2 && f[2] != "-")
+        {
+            e.sha256 = f[2];
+            std::transform(e.sha256.begin(), e.sha256.end(), e.sha256.begin(), ::tolower);
+        }
+        entries.push_back(std::move(e));
+    }
+    return entries;
+}
+
+size_t directory_sync::write_(char * data, size_t size, size_t nmemb, void * arg)
+{
+    // exceptions must not cross libcurl's C frames
+    fetch_ * f = static_cast<fetch_ *>(arg);
+    try
+    {
+        if(!f->file)
+        {
+            make_parents(f->target);
+            f->file.reset(new atomic_file(f->target));
+            f->hash.reset(new digest_sink(digest::sha256, f->file.get()));
+        }
+        f->hash->write(data, size * nmemb);
+    }
+    catch(...)
+    {
+        f->exc = std::current_exception();
+        return 0;
+    }
+    return size * nmemb;
+}
+
+}
+
+#undef ERROR
@@ -0,0 +1,151 @@
+/*
+ * directory_sync.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CURLPP_DIRECTORY_SYNC_H
+#define CURLPP_DIRECTORY_SYNC_H
+
+#include "executor.h"
+#include <cstdio>
+#include <ctime>
+#include <utility>
+#include <vector>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Sink writing to a temporary file next to `path`; `commit` renames it to
+// `path`, so readers see either the old or the complete new file. The
+// temporary file is removed if the object is destroyed before `commit`.
+class atomic_file
+    : public sink
+{
+public:
+    explicit atomic_file(const std::string& path);
+    ~atomic_file();
+
+    atomic_file(const atomic_file& other) = delete;
+    atomic_file& operator = (const atomic_file& other) = delete;
+
+    virtual void write(const char * data, size_t size);
+
+    // flush the data to disk
+    virtual void finish();
+
+    // replace `path` with the written data; calls `finish` if needed
+    void commit();
+
+    inline const std::string& path() const
+    { return path_; }
+
+    inline curl_off_t size() const
+    { return size_; }
+
+private:
+    std::string path_;
+    std::string temp_;
+    FILE * file_;
+    curl_off_t size_;
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// one file of a remote manifest
+struct sync_entry
+{
+    std::string path;           // relative to the synced directory, '/'-separated
+    std::string address;        // where to fetch it from
+    curl_off_t size = -1;       // -1 if unknown
+    std::string sha256;         // lowercase hex, empty if unknown
+    std::string etag;           // empty if unknown
+    time_t modified = -1;       // -1 if unknown
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Mirrors a remote manifest into a local directory.
+//
+// What was fetched is remembered in `<directory>/.curlsync` together with
+// the local file's size and mtime. A file is left alone if it is unchanged
+// on disk and the manifest describes the same version (sha256, ETag or
+// size and modification time) as last time. Otherwise it is fetched, with
+// If-None-Match/If-Modified-Since when an intact local copy exists and the
+// manifest does not name a different sha256, so a manifest without version
+// information costs one 304 per unchanged file.
+//
+// Fetches run concurrently on an executor. Bodies go through a digest_sink
+// into an atomic_file and are renamed into place only after size and sha256
+// have been checked against the manifest. Files fetched by an earlier run
+// that the manifest no longer lists are deleted after all fetches are done;
+// other files in the directory are never touched, except temporary files
+// left next to a listed or recorded file by an interrupted run. A failed
+// fetch keeps the old file. An empty manifest is refused unless
+// `allow_empty` is set.
+class directory_sync
+{
+public:
+    struct options
+    {
+        size_t max_active = 32;
+        long timeout = 0;               // per file, in milliseconds; 0 for none
+        bool remove_stale = true;
+        bool allow_empty = false;       // accept an empty manifest with remove_stale
+    };
+
+    struct report
+    {
+        size_t unchanged = 0;           // skipped without a request
+        size_t not_modified = 0;        // answered with 304
+        size_t fetched = 0;
+        size_t deleted = 0;
+        curl_off_t bytes = 0;
+        std::vector<std::pair<std::string, std::string>> failed;   // path, reason
+    };
+
+    directory_sync(pool& handles, const std::string& directory);
+    directory_sync(pool& handles, const std::string& directory, options opts);
+
+    directory_sync(const directory_sync& other) = delete;
+    directory_sync& operator = (const directory_sync& other) = delete;
+
+    report run(const std::vector<sync_entry>& manifest);
+
+    // Parse a manifest with one "path<TAB>size<TAB>sha256" line per file;
+    // size and sha256 may be "-" or left out. Addresses are `base` resolved
+    // against the percent-encoded path. Empty lines and lines starting with
+    // '#' are skipped.
+    static std::vector<sync_entry> parse_manifest(const std::string& text,
+                                                  const std::string& base);
+
+private:
+    struct local_;
+    struct fetch_;
+
+    pool& handles_;
+    std::string directory_;
+    options opts_;
+
+    static size_t write_(char *, size_t, size_t, void *);
+};
+
+}
+
+#endif /* CURLPP_DIRECTORY_SYNC_H */
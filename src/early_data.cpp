@@ -0,0 +1,78 @@
+/*
+ * early_data.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "early_data.h"
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+early_data::early_data(share& sessions)
+    : sessions_(sessions)
+    , accepted_(0)
+    , rejected_(0)
+    , not_used_(0)
+{
+    sessions_.add(CURL_LOCK_DATA_SSL_SESSION);
+}
+
+void early_data::apply(easy& handle, const std::string& method,
+                       long ssl_options) const
+{
+    sessions_.attach(handle);
+    handle.set(CURLOPT_SSL_SESSIONID_CACHE, 1L);
+
+#ifdef CURLSSLOPT_EARLYDATA
+    if(eligible(method))
+        ssl_options |= CURLSSLOPT_EARLYDATA;
+#else
+    (void)method;
+#endif
+    handle.set(CURLOPT_SSL_OPTIONS, ssl_options);
+}
+
+void early_data::record(const easy& handle)
+{
+#if LIBCURL_VERSION_NUM >= 0x080b00
+    // positive: bytes sent as early data, negative: early data rejected
+    curl_off_t sent = handle.info<curl_off_t>(CURLINFO_EARLYDATA_SENT_T);
+    if(sent > 0)
+        ++accepted_;
+    else if(sent < 0)
+        ++rejected_;
+    else
+        ++not_used_;
+#else
+    (void)handle;
+    ++not_used_;
+#endif
+}
+
+early_data::stats early_data::statistics() const
+{
+    return stats{accepted_, rejected_, not_used_};
+}
+
+bool early_data::eligible(const std::string& method)
+{
+    return method == "GET" || method == "HEAD";
+}
+
+}
@@ -0,0 +1,80 @@
+/*
+ * early_data.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_EARLY_DATA_H
+#define CURLPP_EARLY_DATA_H
+
+#include "curl++.h"
+#include <atomic>
+#include <string>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Opt-in TLS 1.3 early data (0-RTT) for idempotent requests.
+//
+// TLS sessions are cached in the given share object, so a reconnect to an
+// origin can resume the session and send a GET or HEAD with the first flight.
+// Other methods are never sent early, as 0-RTT data can be replayed. If the
+// server rejects the early data, libcurl resends the request after the
+// handshake, so callers see no difference apart from the lost round trip.
+//
+// Needs libcurl 8.11+ built with a TLS backend supporting early data for the
+// option to take effect; older versions still get session resumption.
+class early_data
+{
+public:
+    struct stats
+    {
+        unsigned long accepted;     // request went out as early data
+        unsigned long rejected;     // early data sent but refused by server
+        unsigned long not_used;     // no resumable session, or not eligible
+    };
+
+    explicit early_data(share& sessions);
+
+    early_data(const early_data& other) = delete;
+    early_data& operator = (const early_data& other) = delete;
+
+    // Attach the session cache to `handle` and enable early data if `method`
+    // is GET or HEAD. `method` has to be the one the handle will really send,
+    // since early data can be replayed. `ssl_options` are other CURLSSLOPT_*
+    // bits to keep, as CURLOPT_SSL_OPTIONS is set as a whole.
+    void apply(easy& handle, const std::string& method,
+               long ssl_options = 0) const;
+
+    // account for the outcome of the last transfer on `handle`
+    void record(const easy& handle);
+
+    stats statistics() const;
+
+    static bool eligible(const std::string& method);
+
+private:
+    share& sessions_;
+    std::atomic<unsigned long> accepted_;
+    std::atomic<unsigned long> rejected_;
+    std::atomic<unsigned long> not_used_;
+};
+
+}
+
+#endif /* CURLPP_EARLY_DATA_H */
@@ -0,0 +1,379 @@
+/*
+ * encrypted_file.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "encrypted_file.h"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+namespace
+{
+    // File header, authenticated as additional data of every segment:
+    //   magic[8] segment_size[4, LE] reserved[4] salt[16] nonce_prefix[7] reserved[1]
+    const char magic[8] = {'c', 'u', 'r', 'l', 'g', 'c', 'm', '1'};
+    const size_t header_size = 40;
+    const size_t salt_offset = 16;
+    const size_t salt_size = 16;
+    const size_t prefix_offset = 32;
+    const size_t prefix_size = 7;
+    const size_t tag_size = 16;
+
+    const EVP_CIPHER * cipher_for(const std::string& key)
+    {
+        if(key.size() == 16)
+            return EVP_aes_128_gcm();
+        if(key.size() == 32)
+            return EVP_aes_256_gcm();
+        throw ERROR("AES-GCM key must be 16 or 32 bytes");
+    }
+
+    std::string derive_key(const std::string& key, const std::string& header)
+    {
+        std::string result(key.size(), '\0');
+        size_t len = result.size();
+        const unsigned char * salt =
+            reinterpret_cast<const unsigned char *>(header.data()) + salt_offset;
+        const char info[] = "curl++ encrypted file";
+
+        EVP_PKEY_CTX * ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
+        bool ok = ctx != nullptr
+            && EVP_PKEY_derive_init(ctx) == 1
+            && EVP_PKEY_CTX_set_hkdf_md(ctx, EVP_sha256()) == 1
+            && EVP_PKEY_CTX_set1_hkdf_salt(ctx, salt, salt_size) == 1
+            && EVP_PKEY_CTX_set1_hkdf_key(ctx,
+                   reinterpret_cast<const unsigned char *>(key.data()), key.size()) == 1
+            && EVP_PKEY_CTX_add1_hkdf_info(ctx,
+                   reinterpret_cast<const unsigned char *>(info), sizeof(info) - 1) == 1
+            && EVP_PKEY_derive(ctx, reinterpret_cast<unsigned char *>(&result[0]), &len) == 1;
+        EVP_PKEY_CTX_free(ctx);
+        if(!ok || len != result.size())
+            throw ERROR("Failed to derive file key");
+        return result;
+    }
+
+    // nonce_prefix[7] segment[4, BE] last[1]
+    void make_iv(unsigned char * iv, const std::string& header, uint32_t index, bool last)
+    {
+        memcpy(iv, header.data() + prefix_offset, prefix_size);
+        iv[7] = index >> 24;
+        iv[8] = index >> 16;
+        iv[9] = index >> 8;
+        iv[10] = index;
+        iv[11] = last ? 1 : 0;
+    }
+
+    EVP_CIPHER_CTX * new_context()
+    {
+        EVP_CIPHER_CTX * ctx = EVP_CIPHER_CTX_new();
+        if(ctx == nullptr)
+            throw ERROR("Failed to allocate cipher context");
+        return ctx;
+    }
+
+    void write_all(int fd, const char * data, size_t size)
+    {
+        while(size)
+        {
+            ssize_t n = ::write(fd, data, size);
+            if(n <= 0)
+                throw ERROR("Failed to write encrypted file");
+            data += n;
+            size -= n;
+        }
+    }
+
+    void read_all(int fd, char * data, size_t size, off_t offset)
+    {
+        while(size)
+        {
+            ssize_t n = pread(fd, data, size, offset);
+            if(n <= 0)
+                throw ERROR("Failed to read encrypted file");
+            data += n;
+            size -= n;
+            offset += n;
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+encrypting_sink::encrypting_sink(const std::string& path, const std::string& key,
+                                 size_t segment_size)
+    : fd_(-1)
+    , ctx_(nullptr)
+    , header_(header_size, '\0')
+    , segment_size_(segment_size)
+    , index_(0)
+{
+    const EVP_CIPHER * cipher = cipher_for(key);
+    if(segment_size_ == 0 || segment_size_ > 0x7fffffff)
+        throw ERROR("Invalid segment size");
+
+    memcpy(&header_[0], magic, sizeof(magic));
+    for(int i = 0; i < 4; ++i)
+        header_[8 + i] = static_cast<char>(segment_size_ >> (8 * i));
+    if(RAND_bytes(reinterpret_cast<unsigned char *>(&header_[salt_offset]),
+                  salt_size + prefix_size) != 1)
+        throw ERROR("Failed to generate salt");
+    key_ = derive_key(key, header_);
+
+    ctx_ = new_context();
+    if(EVP_EncryptInit_ex(ctx_, cipher, nullptr, nullptr, nullptr) != 1)
+    {
+        EVP_CIPHER_CTX_free(ctx_);
+        throw ERROR("Failed to initialize cipher");
+    }
+
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd_ < 0)
+    {
+        EVP_CIPHER_CTX_free(ctx_);
+        throw ERROR("Failed to open encrypted file");
+    }
+
+    plain_.reserve(segment_size_);
+    cipher_.resize(segment_size_ + tag_size);
+    try
+    {
+        write_all(fd_, header_.data(), header_.size());
+    }
+    catch(...)
+    {
+        close(fd_);
+        EVP_CIPHER_CTX_free(ctx_);
+        throw;
+    }
+}
+
+encrypting_sink::~encrypting_sink()
+{
+    if(fd_ >= 0)
+        close(fd_);
+    EVP_CIPHER_CTX_free(ctx_);
+    OPENSSL_cleanse(&key_[0], key_.size());
+    OPENSSL_cleanse(&plain_[0], plain_.size());
+}
+
+void encrypting_sink::write(const char * data, size_t size)
+{
+    if(fd_ < 0)
+        throw ERROR("Encrypted file is already finished");
+
+    while(size)
+    {
+        // a full segment is only known not to be the last one once more
+        // data arrives
+        if(plain_.size() == segment_size_)
+            segment_(false);
+
+        size_t len = std::min(size, segment_size_ - plain_.size());
+        plain_.append(data, len);
+        data += len;
+        size -= len;
+    }
+}
+
+void encrypting_sink::finish()
+{
+    if(fd_ < 0)
+        return;
+
+    segment_(true);
+    int fd = fd_;
+    fd_ = -1;
+    if(close(fd) != 0)
+        throw ERROR("Failed to close encrypted file");
+}
+
+void encrypting_sink::segment_(bool last)
+{
+    if(index_ == UINT32_MAX)
+        throw ERROR("Too many segments for one encrypted file");
+
+    unsigned char iv[12];
+    make_iv(iv, header_, index_, last);
+
+    unsigned char * out = reinterpret_cast<unsigned char *>(&cipher_[0]);
+    const unsigned char * in = reinterpret_cast<const unsigned char *>(plain_.data());
+    int len = 0, final_len = 0;
+
+    if(EVP_EncryptInit_ex(ctx_, nullptr, nullptr,
+                          reinterpret_cast<const unsigned char *>(key_.data()), iv) != 1
+       || EVP_EncryptUpdate(ctx_, nullptr, &len,
+                            reinterpret_cast<const unsigned char *>(header_.data()),
+                            header_.size()) != 1
+       || EVP_EncryptUpdate(ctx_, out, &len, in, plain_.size()) != 1
+       || EVP_EncryptFinal_ex(ctx_, out + len, &final_len) != 1
+       || EVP_CIPHER_CTX_ctrl(ctx_, EVP_CTRL_GCM_GET_TAG, tag_size,
+                              out + plain_.size()) != 1)
+        throw ERROR("Failed to encrypt segment");
+
+    write_all(fd_, cipher_.data(), plain_.size() + tag_size);
+    OPENSSL_cleanse(&plain_[0], plain_.size());
+    plain_.clear();
+    ++index_;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+encrypted_reader::encrypted_reader(const std::string& path, const std::string& key)
+    : fd_(-1)
+    , ctx_(nullptr)
+    , header_(header_size, '\0')
+    , segment_size_(0)
+    , segments_(0)
+    , size_(0)
+    , file_size_(0)
+{
+    const EVP_CIPHER * cipher = cipher_for(key);
+
+    fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd_ < 0)
+        throw ERROR("Failed to open encrypted file");
+
+    try
+    {
+        struct stat st;
+        if(fstat(fd_, &st) != 0)
+            throw ERROR("Failed to stat encrypted file");
+        file_size_ = st.st_size;
+        if(file_size_ < header_size + tag_size)
+            throw ERROR("Encrypted file is truncated");
+
+        read_all(fd_, &header_[0], header_size, 0);
+        if(memcmp(header_.data(), magic, sizeof(magic)) != 0)
+            throw ERROR("Not an encrypted file");
+        for(int i = 0; i < 4; ++i)
+            segment_size_ |= static_cast<size_t>(static_cast<unsigned char>(header_[8 + i])) << (8 * i);
+        if(segment_size_ == 0)
+            throw ERROR("Invalid segment size");
+
+        // all segments but the last one are full; the last may be empty
+        uint64_t body = file_size_ - header_size;
+        uint64_t unit = segment_size_ + tag_size;
+        segments_ = (body + unit - 1) / unit;
+        if(body - (segments_ - 1) * unit < tag_size)
+            throw ERROR("Encrypted file is truncated");
+        size_ = body - segments_ * tag_size;
+
+        key_ = derive_key(key, header_);
+        ctx_ = new_context();
+        if(EVP_DecryptInit_ex(ctx_, cipher, nullptr, nullptr, nullptr) != 1)
+            throw ERROR("Failed to initialize cipher");
+    }
+    catch(...)
+    {
+        close(fd_);
+        EVP_CIPHER_CTX_free(ctx_);
+        throw;
+    }
+}
+
+encrypted_reader::~encrypted_reader()
+{
+    close(fd_);
+    EVP_CIPHER_CTX_free(ctx_);
+    OPENSSL_cleanse(&key_[0], key_.size());
+}
+
+std::string encrypted_reader::segment(size_t index) const
+{
+    if(index >= segments_)
+        throw ERROR("Segment index out of range");
+
+    bool last = index + 1 == segments_;
+    uint64_t offset = header_size + index * (segment_size_ + tag_size);
+    size_t len = last ? file_size_ - offset - tag_size : segment_size_;
+
+    std::string cipher(len + tag_size, '\0');
+    read_all(fd_, &cipher[0], cipher.size(), offset);
+
+    unsigned char iv[12];
+    make_iv(iv, header_, index, last);
+
+    std::string plain(len, '\0');
+    unsigned char * out = reinterpret_cast<unsigned char *>(&plain[0]);
+    unsigned char * in = reinterpret_cast<unsigned char *>(&cipher[0]);
+    int n = 0, final_len = 0;
+
+    if(EVP_DecryptInit_ex(ctx_, nullptr, nullptr,
+                          reinterpret_cast<const unsigned char *>(key_.data()), iv) != 1
+       || EVP_DecryptUpdate(ctx_, nullptr, &n,
+                            reinterpret_cast<const unsigned char *>(header_.data()),
+                            header_.size()) != 1
+       || EVP_DecryptUpdate(ctx_, out, &n, in, len) != 1
+       || EVP_CIPHER_CTX_ctrl(ctx_, EVP_CTRL_GCM_SET_TAG, tag_size, in + len) != 1)
+        throw ERROR("Failed to decrypt segment");
+
+    if(EVP_DecryptFinal_ex(ctx_, out + n, &final_len) != 1)
+    {
+        OPENSSL_cleanse(out, len);
+        throw ERROR("Encrypted segment failed authentication");
+    }
+    return plain;
+}
+
+std::string encrypted_reader::read(uint64_t offset, size_t size) const
+{
+    std::string result;
+    if(offset >= size_)
+        return result;
+    if(size > size_ - offset)
+        size = size_ - offset;
+
+    result.reserve(size);
+    size_t index = offset / segment_size_;
+    size_t skip = offset % segment_size_;
+    while(result.size() < size)
+    {
+        std::string data = segment(index++);
+        size_t len = std::min(data.size() - skip, size - result.size());
+        result.append(data, skip, len);
+        skip = 0;
+    }
+    return result;
+}
+
+void encrypted_reader::copy_to(sink& out) const
+{
+    for(size_t i = 0; i < segments_; ++i)
+    {
+        std::string data = segment(i);
+        if(!data.empty())
+            out.write(data.data(), data.size());
+    }
+    out.finish();
+}
+
+}
+
+#undef ERROR
@@ -0,0 +1,115 @@
+/*
+ * encrypted_file.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_ENCRYPTED_FILE_H
+#define CURLPP_ENCRYPTED_FILE_H
+
+#include "curl++.h"
+#include <cstdint>
+#include <string>
+
+typedef struct evp_cipher_ctx_st EVP_CIPHER_CTX;
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Sink encrypting the body into a file with AES-GCM as it arrives.
+//
+// The body is cut into segments of `segment_size` bytes, each encrypted and
+// authenticated on its own, so the file can be written in a single pass and
+// read back at random. Every file gets a random salt, from which a per-file
+// key is derived (HKDF-SHA256), and a random nonce prefix; segment nonces
+// add the segment number and a flag marking the last segment, so reordered,
+// dropped or truncated segments fail authentication. `key` is 16 or 32
+// bytes for AES-128 or AES-256. OpenSSL uses AES-NI and carry-less
+// multiplication instructions where the CPU has them.
+//
+// The file is only complete after finish().
+class encrypting_sink
+    : public sink
+{
+public:
+    encrypting_sink(const std::string& path, const std::string& key,
+                    size_t segment_size = 64 * 1024);
+    ~encrypting_sink();
+
+    encrypting_sink(const encrypting_sink& other) = delete;
+    encrypting_sink& operator = (const encrypting_sink& other) = delete;
+
+    virtual void write(const char * data, size_t size);
+    virtual void finish();
+
+private:
+    int fd_;
+    EVP_CIPHER_CTX * ctx_;
+    std::string header_;
+    std::string key_;           // per-file key
+    size_t segment_size_;
+    std::string plain_;
+    std::string cipher_;
+    uint32_t index_;
+
+    void segment_(bool last);
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// random access to files written by encrypting_sink; every segment is
+// authenticated before any of its bytes are returned
+class encrypted_reader
+{
+public:
+    encrypted_reader(const std::string& path, const std::string& key);
+    ~encrypted_reader();
+
+    encrypted_reader(const encrypted_reader& other) = delete;
+    encrypted_reader& operator = (const encrypted_reader& other) = delete;
+
+    // plaintext size
+    inline uint64_t size() const
+    { return size_; }
+
+    inline size_t segments() const
+    { return segments_; }
+
+    std::string segment(size_t index) const;
+
+    // `size` bytes starting at plaintext `offset`
+    std::string read(uint64_t offset, size_t size) const;
+
+    // decrypt everything into `out`, including the call to out.finish()
+    void copy_to(sink& out) const;
+
+private:
+    int fd_;
+    EVP_CIPHER_CTX * ctx_;
+    std::string header_;
+    std::string key_;
+    size_t segment_size_;
+    size_t segments_;
+    uint64_t size_;
+    uint64_t file_size_;
+};
+
+}
+
+#endif /* CURLPP_ENCRYPTED_FILE_H */
@@ -0,0 +1,108 @@
+/*
+ * executor.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "executor.h"
+
+namespace curl
+{
+
+executor::executor(pool& handles, size_t max_active)
+    : handles_(handles)
+    , max_active_(max_active ? max_active : 1)
+{}
+
+executor::~executor()
+{
+    // run() may have been left by an exception with transfers still added;
+    // nothing may be thrown from here
+    for(auto&& t : active_)
+    {
+        try
+        {
+            multi_.remove(t.first);
+        }
+        catch(const error&)
+        {}
+    }
+}
+
+void executor::add(const std::string& address, setup configure, completion done)
+{
+    queued_.push_back(request_{address, std::move(configure), std::move(done)});
+}
+
+void executor::run(source feed)
+{
+    bool more = static_cast<bool>(feed);
+    for(;;)
+    {
+        if(more && active_.size() + queued_.size() < max_active_)
+            more = feed(*this, max_active_ - active_.size() - queued_.size());
+
+        while(!queued_.empty() && active_.size() < max_active_)
+        {
+            request_ r = std::move(queued_.front());
+            queued_.pop_front();
+            start_(r);
+        }
+
+        if(active_.empty() && queued_.empty())
+        {
+            if(!more)
+                return;
+            // the source has nothing right now; don't spin
+            multi_.poll(10);
+            continue;
+        }
+
+        multi_.perform();
+
+        CURL * handle;
+        CURLcode result;
+        while(multi_.next_done(handle, result))
+        {
+            auto it = active_.find(handle);
+            if(it == active_.end())
+                continue;
+
+            multi_.remove(handle);
+            std::unique_ptr<transfer_> t = std::move(it->second);
+            active_.erase(it);
+            if(t->done)
+                t->done(*t->handle, result);
+        }
+
+        if(!active_.empty())
+            multi_.poll(100);
+    }
+}
+
+void executor::start_(request_& r)
+{
+    std::unique_ptr<transfer_> t(new transfer_{handles_.acquire(r.address),
+                                               std::move(r.done)});
+    if(r.configure)
+        r.configure(*t->handle);
+
+    CURL * handle = (*t->handle).handle();
+    multi_.add(handle);
+    active_[handle] = std::move(t);
+}
+
+}
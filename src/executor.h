@@ -0,0 +1,100 @@
+/*
+ * executor.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_EXECUTOR_H
+#define CURLPP_EXECUTOR_H
+
+#include "pool.h"
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Runs many transfers concurrently on one multi handle.
+//
+// Handles are leased from a pool, so consecutive transfers to an origin
+// reuse its connections. At most `max_active` transfers run at once; further
+// ones wait in a queue. `run` can pull work from a source whenever there is
+// room, which keeps a large backlog (e.g. a crawl frontier) out of memory
+// until it is needed.
+class executor
+{
+public:
+    // configure the handle (sinks, options) before the transfer starts
+    typedef std::function<void(easy&)> setup;
+
+    // called on the thread running `run` once the transfer is done; the
+    // handle goes back to the pool afterwards
+    typedef std::function<void(easy&, CURLcode)> completion;
+
+    // Called with the number of free transfer slots; adds work with `add`.
+    // Returns false once it will never produce more work.
+    typedef std::function<bool(executor&, size_t room)> source;
+
+    explicit executor(pool& handles, size_t max_active = 64);
+    ~executor();
+
+    executor(const executor& other) = delete;
+    executor& operator = (const executor& other) = delete;
+
+    void add(const std::string& address, setup configure, completion done);
+
+    // Drive transfers until all are done and `feed` is exhausted.
+    // Exceptions thrown by `setup` or `completion` functions propagate;
+    // `run` can be called again afterwards to continue.
+    void run(source feed = source());
+
+    inline size_t active() const
+    { return active_.size(); }
+
+    inline size_t queued() const
+    { return queued_.size(); }
+
+private:
+    struct request_
+    {
+        std::string address;
+        setup configure;
+        completion done;
+    };
+
+    struct transfer_
+    {
+        pool::lease handle;
+        completion done;
+    };
+
+    pool& handles_;
+    size_t max_active_;
+    multi multi_;
+    std::deque<request_> queued_;
+    std::map<CURL *, std::unique_ptr<transfer_>> active_;
+
+    void start_(request_& r);
+};
+
+}
+
+#endif /* CURLPP_EXECUTOR_H */
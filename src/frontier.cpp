@@ -0,0 +1,414 @@
+/*
+ * frontier.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frontier.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+namespace
+{
+    // FNV-1a, finished with the splitmix64 mixer for better bit dispersion
+    uint64_t hash(const std::string& key)
+    {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for(unsigned char c : key)
+            h = (h ^ c) * 0x100000001b3ULL;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
+    }
+
+    uint64_t rehash(uint64_t h)
+    {
+        h = (h ^ (h >> 33)) * 0xff51afd7ed558ccdULL;
+        h = (h ^ (h >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+        return (h ^ (h >> 33)) | 1;
+    }
+
+    // on-disk layout of a spilled frontier item, followed by the URL
+    struct record
+    {
+        uint32_t length;
+        int32_t priority;
+        uint64_t seq;
+    };
+
+    // smallest spill file worth compacting
+    const uint64_t compact_threshold = 1 << 20;
+
+    void write_all(int fd, const char * ptr, size_t left, off_t offset)
+    {
+        while(left)
+        {
+            ssize_t n = pwrite(fd, ptr, left, offset);
+            if(n <= 0)
+                throw ERROR("Failed to write frontier spill file");
+            ptr += n;
+            left -= n;
+            offset += n;
+        }
+    }
+
+    void read_all(int fd, char * ptr, size_t left, off_t offset)
+    {
+        while(left)
+        {
+            ssize_t n = pread(fd, ptr, left, offset);
+            if(n <= 0)
+                throw ERROR("Failed to read frontier spill file");
+            ptr += n;
+            left -= n;
+            offset += n;
+        }
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+bloom_filter::bloom_filter(uint64_t capacity, double false_positive)
+    : false_positive_(false_positive)
+    , count_(0)
+{
+    if(!(false_positive_ > 0.0 && false_positive_ < 1.0))
+        throw ERROR("Bloom filter error rate must be between 0 and 1");
+
+    grow_(std::max<uint64_t>(capacity, 64));
+}
+
+bool bloom_filter::insert(const std::string& key)
+{
+    uint64_t h1 = hash(key);
+    uint64_t h2 = rehash(h1);
+    for(auto&& s : slices_)
+        if(test_(s, h1, h2))
+            return false;
+
+    if(slices_.back().count >= slices_.back().capacity)
+        grow_(slices_.back().capacity * 2);
+
+    slice_& s = slices_.back();
+    for(unsigned int i = 0; i < s.hashes; ++i)
+    {
+        uint64_t bit = (h1 + i * h2) & s.mask;
+        s.bits[bit >> 6] |= uint64_t(1) << (bit & 63);
+    }
+    ++s.count;
+    ++count_;
+    return true;
+}
+
+bool bloom_filter::contains(const std::string& key) const
+{
+    uint64_t h1 = hash(key);
+    uint64_t h2 = rehash(h1);
+    for(auto&& s : slices_)
+        if(test_(s, h1, h2))
+            return true;
+    return false;
+}
+
+uint64_t bloom_filter::bytes() const
+{
+    uint64_t total = 0;
+    for(auto&& s : slices_)
+        total += s.bits.size() * sizeof(uint64_t);
+    return total;
+}
+
+void bloom_filter::grow_(uint64_t capacity)
+{
+    // Slice i gets error rate p/2^(i+1), so the rates of all slices sum up
+    // to less than p.
+    double p = false_positive_ / std::pow(2.0, static_cast<double>(slices_.size() + 1));
+    slices_.emplace_back();
+    slice_& s = slices_.back();
+    s.capacity = capacity;
+    s.count = 0;
+    double ln2 = std::log(2.0);
+    double bits = std::ceil(s.capacity * -std::log(p) / (ln2 * ln2));
+
+    uint64_t m = 64;
+    while(m < bits)
+        m <<= 1;
+    s.bits.assign(m / 64, 0);
+    s.mask = m - 1;
+    s.hashes = std::max(1, static_cast<int>(std::ceil(-std::log2(p))));
+}
+
+bool bloom_filter::test_(const slice_& s, uint64_t h1, uint64_t h2)
+{
+    for(unsigned int i = 0; i < s.hashes; ++i)
+    {
+        uint64_t bit = (h1 + i * h2) & s.mask;
+        if(!(s.bits[bit >> 6] & (uint64_t(1) << (bit & 63))))
+            return false;
+    }
+    return true;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+frontier::frontier(const std::string& directory)
+    : frontier(directory, options())
+{}
+
+frontier::frontier(const std::string& directory, options opts)
+    : path_(directory + "/frontier.spill")
+    , opts_(opts)
+    , fd_(-1)
+    , spill_size_(0)
+    , live_bytes_(0)
+    , spilled_blocks_(0)
+    , seen_(opts.expected_urls, opts.false_positive)
+    , size_(0)
+    , seq_(0)
+{
+    opts_.memory_per_host = std::max<size_t>(opts_.memory_per_host, 8);
+    fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd_ < 0)
+        throw ERROR("Failed to open frontier spill file");
+}
+
+frontier::~frontier()
+{
+    close(fd_);
+    unlink(path_.c_str());
+}
+
+bool frontier::push(const std::string& address, int priority)
+{
+    std::string normalized, name;
+    try
+    {
+        url u(address);
+        CURLUcode code = curl_url_set(u.handle(), CURLUPART_FRAGMENT, nullptr, 0);
+        if(code != CURLUE_OK)
+            return false;
+        normalized = u.str();
+        name = u.get(CURLUPART_HOST);
+    }
+    catch(const error&)
+    {
+        return false;
+    }
+
+    if(!seen_.insert(normalized))
+        return false;
+
+    std::unique_ptr<host_>& slot = hosts_[name];
+    if(!slot)
+    {
+        slot.reset(new host_);
+        slot->name = name;
+    }
+    host_& h = *slot;
+
+    h.heap.push_back(item_{std::move(normalized), priority, seq_++});
+    std::push_heap(h.heap.begin(), h.heap.end());
+    ++size_;
+
+    if(h.heap.size() > opts_.memory_per_host)
+        spill_(h);
+    if(!h.scheduled)
+        schedule_host_(h, h.due);
+    return true;
+}
+
+std::vector<frontier::entry> frontier::next(size_t max)
+{
+    std::vector<entry> result;
+    clock::time_point now = clock::now();
+
+    std::vector<host_ *> due;
+    for(auto it = schedule_.begin(); it != schedule_.end() && it->first <= now; ++it)
+        due.push_back(it->second);
+
+    // hosts with the most urgent work first
+    std::stable_sort(due.begin(), due.end(), [](host_ * a, host_ * b) {
+        return b->heap.front() < a->heap.front();
+    });
+    if(due.size() > max)
+        due.resize(max);
+
+    for(host_ * h : due)
+    {
+        std::pop_heap(h->heap.begin(), h->heap.end());
+        item_& top = h->heap.back();
+        result.push_back(entry{std::move(top.url), h->name, top.priority});
+        h->heap.pop_back();
+        --size_;
+        refill_(*h);
+
+        if(!h->heap.empty())
+            schedule_host_(*h, now + opts_.delay);
+        else
+        {
+            schedule_.erase(slot_(h->due, h));
+            h->scheduled = false;
+            h->due = now + opts_.delay;
+        }
+    }
+    return result;
+}
+
+std::chrono::milliseconds frontier::wait() const
+{
+    if(schedule_.empty())
+        return std::chrono::milliseconds(0);
+
+    clock::time_point due = schedule_.begin()->first;
+    clock::time_point now = clock::now();
+    if(due <= now)
+        return std::chrono::milliseconds(0);
+    return std::chrono::duration_cast<std::chrono::milliseconds>(due - now)
+        + std::chrono::milliseconds(1);
+}
+
+void frontier::spill_(host_& h)
+{
+    // sort_heap leaves the items in ascending order, lowest priority first
+    std::sort_heap(h.heap.begin(), h.heap.end());
+    size_t count = h.heap.size() / 2;
+
+    std::string buf;
+    for(size_t i = 0; i < count; ++i)
+    {
+        const item_& it = h.heap[i];
+        record r{static_cast<uint32_t>(it.url.size()), it.priority, it.seq};
+        buf.append(reinterpret_cast<const char *>(&r), sizeof(r));
+        buf += it.url;
+    }
+
+    write_all(fd_, buf.data(), buf.size(), spill_size_);
+
+    h.spilled.push_back(block_{spill_size_, buf.size()});
+    h.spilled_count += count;
+    spill_size_ += buf.size();
+    live_bytes_ += buf.size();
+    ++spilled_blocks_;
+
+    h.heap.erase(h.heap.begin(), h.heap.begin() + count);
+    std::make_heap(h.heap.begin(), h.heap.end());
+}
+
+void frontier::refill_(host_& h)
+{
+    if(h.spilled.empty() || h.heap.size() > opts_.memory_per_host / 4)
+        return;
+
+    block_ b = h.spilled.front();
+    h.spilled.pop_front();
+
+    std::string buf(b.bytes, '\0');
+    read_all(fd_, &buf[0], buf.size(), b.offset);
+
+    size_t pos = 0;
+    while(pos + sizeof(record) <= buf.size())
+    {
+        record r;
+        memcpy(&r, buf.data() + pos, sizeof(r));
+        pos += sizeof(r);
+        h.heap.push_back(item_{buf.substr(pos, r.length), r.priority, r.seq});
+        std::push_heap(h.heap.begin(), h.heap.end());
+        pos += r.length;
+        --h.spilled_count;
+    }
+
+    // reclaim the spill file once nothing in it is live anymore, or most
+    // of it is not
+    live_bytes_ -= b.bytes;
+    if(--spilled_blocks_ == 0)
+    {
+        spill_size_ = 0;
+        if(ftruncate(fd_, 0) != 0)
+            throw ERROR("Failed to truncate frontier spill file");
+    }
+    else if(spill_size_ >= compact_threshold && spill_size_ - live_bytes_ > live_bytes_)
+        compact_();
+}
+
+void frontier::compact_()
+{
+    // copy the live blocks into a new file, which replaces the old one only
+    // when complete; the blocks are updated after that
+    std::string temp = path_ + ".tmp";
+    int fd = open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0)
+        throw ERROR("Failed to open frontier spill file");
+
+    std::vector<uint64_t> offsets;
+    offsets.reserve(spilled_blocks_);
+    uint64_t end = 0;
+    try
+    {
+        std::string buf;
+        for(auto&& h : hosts_)
+            for(auto&& b : h.second->spilled)
+            {
+                buf.resize(b.bytes);
+                read_all(fd_, &buf[0], buf.size(), b.offset);
+                write_all(fd, buf.data(), buf.size(), end);
+                offsets.push_back(end);
+                end += b.bytes;
+            }
+
+        if(rename(temp.c_str(), path_.c_str()) != 0)
+            throw ERROR("Failed to replace frontier spill file");
+    }
+    catch(...)
+    {
+        close(fd);
+        unlink(temp.c_str());
+        throw;
+    }
+
+    close(fd_);
+    fd_ = fd;
+    spill_size_ = end;
+
+    auto next = offsets.begin();
+    for(auto&& h : hosts_)
+        for(auto&& b : h.second->spilled)
+            b.offset = *next++;
+}
+
+void frontier::schedule_host_(host_& h, clock::time_point due)
+{
+    if(h.scheduled)
+        schedule_.erase(slot_(h.due, &h));
+    h.due = due;
+    schedule_.insert(slot_(due, &h));
+    h.scheduled = true;
+}
+
+}
+
+#undef ERROR
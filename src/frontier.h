@@ -0,0 +1,194 @@
+/*
+ * frontier.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_FRONTIER_H
+#define CURLPP_FRONTIER_H
+
+#include "curl++.h"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Scalable Bloom filter for set membership of strings.
+//
+// Starts with a single filter sized for `capacity` items; whenever the newest
+// filter is full another one with twice the capacity and a tighter error
+// rate is added, so the overall false positive rate stays below
+// `false_positive` however many items are inserted.
+class bloom_filter
+{
+public:
+    explicit bloom_filter(uint64_t capacity = 1 << 20, double false_positive = 0.001);
+
+    // add `key`; returns false if it was (probably) present already
+    bool insert(const std::string& key);
+    bool contains(const std::string& key) const;
+
+    inline uint64_t size() const
+    { return count_; }
+
+    // memory used by the bit arrays
+    uint64_t bytes() const;
+
+private:
+    struct slice_
+    {
+        std::vector<uint64_t> bits;
+        uint64_t mask;              // bit count - 1, a power of two
+        unsigned int hashes;
+        uint64_t capacity;
+        uint64_t count;
+    };
+
+    std::vector<slice_> slices_;
+    double false_positive_;
+    uint64_t count_;
+
+    void grow_(uint64_t capacity);
+    static bool test_(const slice_& s, uint64_t h1, uint64_t h2);
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Crawl frontier: URLs waiting to be fetched, partitioned by host.
+//
+// Every host has its own priority queue (higher priority first, FIFO among
+// equals) and is handed out at most once per `delay`. Only the head of each
+// host queue is kept in memory; beyond `memory_per_host` entries the lower
+// priority half is written as a block to a spill file in `directory` and
+// read back when the in-memory part runs low, so priority order is exact in
+// memory and approximate across spilled blocks. Once blocks already read
+// back make up most of the spill file, the others are copied to a new one,
+// so it stays within about twice the size of the spilled data. Seen URLs
+// are remembered in a scalable Bloom filter, so a URL is queued at most once.
+class frontier
+{
+public:
+    struct options
+    {
+        size_t memory_per_host = 256;
+        std::chrono::milliseconds delay = std::chrono::milliseconds(1000);
+        uint64_t expected_urls = 1 << 20;
+        double false_positive = 0.001;
+    };
+
+    struct entry
+    {
+        std::string url;
+        std::string host;
+        int priority;
+    };
+
+    explicit frontier(const std::string& directory);
+    frontier(const std::string& directory, options opts);
+    ~frontier();
+
+    frontier(const frontier& other) = delete;
+    frontier& operator = (const frontier& other) = delete;
+
+    // Queue `address` (its fragment removed) unless it has been seen before
+    // or does not parse; returns whether it was queued.
+    bool push(const std::string& address, int priority = 0);
+
+    // Up to `max` URLs from hosts that are due, at most one per host, from
+    // the hosts with the highest priority heads first.
+    std::vector<entry> next(size_t max);
+
+    // time until the next host becomes due; zero if one is due now or the
+    // frontier is empty
+    std::chrono::milliseconds wait() const;
+
+    inline size_t size() const
+    { return size_; }
+
+    inline bool empty() const
+    { return size_ == 0; }
+
+    inline size_t hosts() const
+    { return hosts_.size(); }
+
+    inline const bloom_filter& seen() const
+    { return seen_; }
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct item_
+    {
+        std::string url;
+        int priority;
+        uint64_t seq;               // insertion order, for FIFO among equals
+
+        bool operator < (const item_& other) const
+        {
+            return priority != other.priority ?
+                priority < other.priority : seq > other.seq;
+        }
+    };
+
+    struct block_
+    {
+        uint64_t offset;
+        uint64_t bytes;
+    };
+
+    struct host_
+    {
+        std::string name;
+        std::vector<item_> heap;    // max-heap on item_::operator<
+        std::deque<block_> spilled;
+        size_t spilled_count = 0;
+        clock::time_point due;
+        bool scheduled = false;
+    };
+
+    typedef std::pair<clock::time_point, host_ *> slot_;
+
+    std::string path_;
+    options opts_;
+    int fd_;
+    uint64_t spill_size_;           // end of the spill file
+    uint64_t live_bytes_;           // of blocks not read back yet
+    size_t spilled_blocks_;
+    bloom_filter seen_;
+    std::map<std::string, std::unique_ptr<host_>> hosts_;
+    std::set<slot_> schedule_;      // non-empty hosts by due time
+    size_t size_;
+    uint64_t seq_;
+
+    void spill_(host_& h);
+    void refill_(host_& h);
+    void compact_();
+    void schedule_host_(host_& h, clock::time_point due);
+};
+
+}
+
+#endif /* CURLPP_FRONTIER_H */
@@ -0,0 +1,210 @@
+/*
+ * health.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "health.h"
+#include <algorithm>
+#include <random>
+
+namespace curl
+{
+
+namespace
+{
+    size_t discard(char *, size_t size, size_t nmemb, void *)
+    {
+        return size*nmemb;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+health_checker::health_checker(pool& handles, options opts)
+    : handles_(handles)
+    , opts_(std::move(opts))
+    , next_(0)
+    , running_(false)
+{}
+
+health_checker::~health_checker()
+{
+    stop();
+}
+
+void health_checker::add(const std::string& endpoint)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto&& e : endpoints_)
+        if(e.state.endpoint == endpoint)
+            return;
+    endpoints_.push_back(entry_{endpoint_state{endpoint, true, 0, 0, 0.0}, 0});
+}
+
+void health_checker::remove(const std::string& endpoint)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    endpoints_.erase(
+        std::remove_if(endpoints_.begin(), endpoints_.end(),
+            [&](const entry_& e){ return e.state.endpoint == endpoint; }),
+        endpoints_.end());
+}
+
+void health_checker::start()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(running_)
+        return;
+    running_ = true;
+    thread_ = std::thread(&health_checker::run_, this);
+}
+
+void health_checker::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(!running_)
+            return;
+        running_ = false;
+    }
+    wakeup_.notify_all();
+    thread_.join();
+}
+
+void health_checker::check_now()
+{
+    std::vector<std::string> targets;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for(auto&& e : endpoints_)
+            targets.push_back(e.state.endpoint);
+    }
+
+    for(auto&& endpoint : targets)
+    {
+        double latency = 0.0;
+        bool ok = probe_(endpoint, latency);
+        update_(endpoint, ok, latency);
+    }
+}
+
+bool health_checker::healthy(const std::string& endpoint) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto&& e : endpoints_)
+        if(e.state.endpoint == endpoint)
+            return e.state.healthy;
+    return false;
+}
+
+std::string health_checker::select()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(endpoints_.empty())
+        return std::string();
+
+    size_t count = std::count_if(endpoints_.begin(), endpoints_.end(),
+        [](const entry_& e){ return e.state.healthy; });
+    unsigned long n = next_++;
+
+    if(count == 0)
+        return endpoints_[n % endpoints_.size()].state.endpoint;
+
+    n %= count;
+    for(auto&& e : endpoints_)
+        if(e.state.healthy && n-- == 0)
+            return e.state.endpoint;
+    return std::string();
+}
+
+std::vector<health_checker::endpoint_state> health_checker::states() const
+{
+    std::vector<endpoint_state> result;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto&& e : endpoints_)
+        result.push_back(e.state);
+    return result;
+}
+
+void health_checker::run_()
+{
+    // spread probes of many checkers (or processes) over the interval
+    std::minstd_rand rng(std::random_device{}());
+    std::uniform_real_distribution<double> jitter(0.9, 1.1);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(running_)
+    {
+        lock.unlock();
+        check_now();
+        lock.lock();
+
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+            opts_.interval * jitter(rng));
+        wakeup_.wait_for(lock, wait, [this]{ return !running_; });
+    }
+}
+
+bool health_checker::probe_(const std::string& endpoint, double& latency)
+{
+    try
+    {
+        pool::lease handle = handles_.acquire(endpoint + opts_.path);
+        handle.untracked();
+        handle->set(CURLOPT_TIMEOUT_MS, static_cast<long>(opts_.timeout.count()));
+        handle->set(CURLOPT_NOSIGNAL, 1L);
+        handle->set(CURLOPT_WRITEFUNCTION, discard);
+        if(opts_.head)
+            handle->set(CURLOPT_NOBODY, 1L);
+        handle->perform();
+
+        latency = handle->info<curl_off_t>(CURLINFO_TOTAL_TIME_T) / 1e6;
+        return handle->info<long>(CURLINFO_RESPONSE_CODE) == opts_.expected_status;
+    }
+    catch(const error&)
+    {
+        return false;
+    }
+}
+
+void health_checker::update_(const std::string& endpoint, bool ok, double latency)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto&& e : endpoints_)
+    {
+        if(e.state.endpoint != endpoint)
+            continue;
+
+        ++e.state.probes;
+        if(ok)
+            e.state.last_latency = latency;
+        else
+            ++e.state.failures;
+
+        // flip state only after enough consecutive contrary results
+        if(ok == e.state.healthy)
+            e.streak = 0;
+        else if(++e.streak >= (ok ? opts_.rise : opts_.fall))
+        {
+            e.state.healthy = ok;
+            e.streak = 0;
+        }
+        return;
+    }
+}
+
+}
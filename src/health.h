@@ -0,0 +1,116 @@
+/*
+ * health.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_HEALTH_H
+#define CURLPP_HEALTH_H
+
+#include "pool.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Background prober for a set of backend endpoints.
+//
+// A single thread probes one endpoint after the other, so probing never uses
+// more than one connection at a time. Probes go through the pool: they reuse
+// an idle handle's connection when there is one, and leave a warm connection
+// behind for the next real request when there is not. Their leases are
+// untracked, so probes neither show up in the pool's statistics nor shrink
+// the buffer sizes tuned for real transfers.
+class health_checker
+{
+public:
+    struct options
+    {
+        std::string path = "/";
+        long expected_status = 200;
+        std::chrono::milliseconds interval = std::chrono::milliseconds(5000);
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(2000);
+        bool head = false;          // probe with HEAD instead of GET
+        unsigned int fall = 2;      // consecutive failures to mark as down
+        unsigned int rise = 1;      // consecutive successes to mark as up
+    };
+
+    struct endpoint_state
+    {
+        std::string endpoint;
+        bool healthy;
+        unsigned long probes;
+        unsigned long failures;
+        double last_latency;        // seconds, of the last successful probe
+    };
+
+    health_checker(pool& handles, options opts);
+    ~health_checker();
+
+    health_checker(const health_checker& other) = delete;
+    health_checker& operator = (const health_checker& other) = delete;
+
+    // `endpoint` is a base URL such as "https://10.0.0.1:8443"; new
+    // endpoints count as healthy until probes say otherwise
+    void add(const std::string& endpoint);
+    void remove(const std::string& endpoint);
+
+    void start();
+    void stop();
+
+    // probe every endpoint once on the calling thread
+    void check_now();
+
+    bool healthy(const std::string& endpoint) const;
+
+    // Round-robin over the healthy endpoints; falls back to all endpoints
+    // when none is healthy, and returns an empty string when there are none.
+    std::string select();
+
+    std::vector<endpoint_state> states() const;
+
+private:
+    struct entry_
+    {
+        endpoint_state state;
+        unsigned int streak;        // consecutive results contradicting `healthy`
+    };
+
+    pool& handles_;
+    options opts_;
+    mutable std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::vector<entry_> endpoints_;
+    std::atomic<unsigned long> next_;
+    std::thread thread_;
+    bool running_;
+
+    void run_();
+    bool probe_(const std::string& endpoint, double& latency);
+    void update_(const std::string& endpoint, bool ok, double latency);
+};
+
+}
+
+#endif /* CURLPP_HEALTH_H */
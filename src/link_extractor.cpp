@@ -0,0 +1,379 @@
+/*
+ * link_extractor.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "link_extractor.h"
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+namespace curl
+{
+
+namespace
+{
+    // tags are buffered up to this size; longer ones are skipped
+    const size_t max_tag = 64 * 1024;
+
+    inline bool space(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+    }
+
+    inline char lower(char c)
+    {
+        return static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    }
+
+    // replace character references; only the ones that matter in URLs
+    std::string unescape(const std::string& value)
+    {
+        if(value.find('&') == std::string::npos)
+            return value;
+
+        std::string result;
+        result.reserve(value.size());
+        for(size_t i = 0; i < value.size(); ++i)
+        {
+            size_t end;
+            if(value[i] != '&' || (end = value.find(';', i)) == std::string::npos
+               || end - i > 10)
+            {
+                result.push_back(value[i]);
+                continue;
+            }
+
+            std::string name = value.substr(i + 1, end - i - 1);
+            long code = -1;
+            if(name == "amp")
+                code = '&';
+            else if(name == "quot")
+                code = '"';
+            else if(name == "apos")
+                code = '\'';
+            else if(name == "lt")
+                code = '<';
+            else if(name == "gt")
+                code = '>';
+            else if(name.size() > 1 && name[0] == '#')
+            {
+                bool hex = name[1] == 'x' || name[1] == 'X';
+                char * stop;
+                code = strtol(name.c_str() + (hex ? 2 : 1), &stop, hex ? 16 : 10);
+                if(*stop != '\0' || code <= 0 || code > 0x7f)
+                    code = -1;
+            }
+
+            if(code < 0)
+                result.push_back('&');
+            else
+            {
+                result.push_back(static_cast<char>(code));
+                i = end;
+            }
+        }
+        return result;
+    }
+
+    // URL attribute values lose surrounding whitespace and embedded newlines;
+    // spaces and non-ASCII bytes are percent-encoded like browsers do
+    std::string clean(const std::string& value)
+    {
+        static const char digits[] = "0123456789ABCDEF";
+
+        std::string result;
+        size_t begin = 0, end = value.size();
+        while(begin < end && space(value[begin]))
+            ++begin;
+        while(end > begin && space(value[end-1]))
+            --end;
+        for(size_t i = begin; i < end; ++i)
+        {
+            unsigned char c = value[i];
+            if(c == '\n' || c == '\r' || c == '\t')
+                continue;
+            if(c > ' ' && c < 0x7f)
+                result.push_back(c);
+            else
+            {
+                result.push_back('%');
+                result.push_back(digits[c >> 4]);
+                result.push_back(digits[c & 15]);
+            }
+        }
+        return result;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+link_extractor::link_extractor(const std::string& base, link_callback cb)
+    : base_(base)
+    , base_set_(false)
+    , cb_(std::move(cb))
+    , state_(in_text)
+    , quote_(0)
+    , value_(false)
+    , dashes_(0)
+    , matched_(0)
+    , links_(0)
+{}
+
+void link_extractor::write(const char * data, size_t size)
+{
+    const char * end = data + size;
+    while(data < end)
+    {
+        switch(state_)
+        {
+        case in_text:
+        case in_raw:
+        {
+            const char * lt = static_cast<const char *>(memchr(data, '<', end - data));
+            if(lt == nullptr)
+                return;
+            data = lt + 1;
+            if(state_ == in_raw)
+            {
+                state_ = in_raw_end;
+                matched_ = 0;
+            }
+            else
+            {
+                state_ = in_tag;
+                tag_.clear();
+                quote_ = 0;
+                value_ = false;
+            }
+            break;
+        }
+
+        case in_raw_end:
+            // only "</script" (or "</style") ends raw text
+            if(lower(*data) != end_tag_[matched_])
+            {
+                state_ = in_raw;
+                break;
+            }
+            ++data;
+            if(++matched_ == end_tag_.size())
+            {
+                state_ = in_tag;
+                tag_ = end_tag_;
+                quote_ = 0;
+                value_ = false;
+            }
+            break;
+
+        case in_tag:
+        {
+            // "<!--" starts a comment, whatever follows
+            size_t len = tag_.size();
+            if(len < 3 && tag_.compare(0, len, "!--", len) == 0 && *data == "!--"[len])
+            {
+                tag_.push_back(*data++);
+                if(len == 2)
+                {
+                    state_ = in_comment;
+                    dashes_ = 0;
+                }
+                break;
+            }
+
+            const char * start = data;
+            for(; data < end; ++data)
+            {
+                char c = *data;
+                if(quote_)
+                {
+                    if(c == quote_)
+                        quote_ = 0;
+                }
+                else if((c == '"' || c == '\'') && value_)
+                    quote_ = c;
+                else if(c == '>')
+                    break;
+                else if(c == '=')
+                    value_ = true;
+                else if(!space(c))
+                    value_ = false;
+            }
+
+            tag_.append(start, std::min<size_t>(data - start, max_tag - tag_.size()));
+            if(data == end)
+                return;
+            ++data;
+            state_ = in_text;
+            if(tag_.size() < max_tag)
+                tag_done_();
+            break;
+        }
+
+        case in_comment:
+            for(; data < end; ++data)
+            {
+                if(*data == '-')
+                    ++dashes_;
+                else if(*data == '>' && dashes_ >= 2)
+                {
+                    state_ = in_text;
+                    ++data;
+                    break;
+                }
+                else
+                    dashes_ = 0;
+            }
+            break;
+        }
+    }
+}
+
+void link_extractor::finish()
+{
+    state_ = in_text;
+    tag_.clear();
+}
+
+void link_extractor::tag_done_()
+{
+    size_t pos = 0, n = tag_.size();
+
+    if(!end_tag_.empty())
+    {
+        // "</script" has to be followed by a delimiter, unlike "</scripts>"
+        size_t m = end_tag_.size();
+        if(n == m || space(tag_[m]) || tag_[m] == '/')
+            end_tag_.clear();
+        else
+            state_ = in_raw;
+        return;
+    }
+
+    // end tags, doctypes and processing instructions carry no links
+    std::string name;
+    while(pos < n && !space(tag_[pos]) && tag_[pos] != '/')
+        name.push_back(lower(tag_[pos++]));
+    if(name.empty() || !isalpha(static_cast<unsigned char>(name[0])))
+        return;
+
+    bool self_closing = n > 0 && tag_[n-1] == '/';
+    while(pos < n)
+    {
+        while(pos < n && (space(tag_[pos]) || tag_[pos] == '/'))
+            ++pos;
+
+        std::string attr;
+        while(pos < n && !space(tag_[pos]) && tag_[pos] != '=' && tag_[pos] != '/')
+            attr.push_back(lower(tag_[pos++]));
+        while(pos < n && space(tag_[pos]))
+            ++pos;
+        if(pos >= n || tag_[pos] != '=')
+            continue;
+        ++pos;
+        while(pos < n && space(tag_[pos]))
+            ++pos;
+
+        std::string value;
+        if(pos < n && (tag_[pos] == '"' || tag_[pos] == '\''))
+        {
+            char q = tag_[pos++];
+            size_t close = tag_.find(q, pos);
+            if(close == std::string::npos)
+                close = n;
+            value = tag_.substr(pos, close - pos);
+            pos = close + 1;
+        }
+        else
+        {
+            size_t start = pos;
+            while(pos < n && !space(tag_[pos]))
+                ++pos;
+            value = tag_.substr(start, pos - start);
+        }
+
+        if(attr == "href" || attr == "src")
+        {
+            if(name == "base")
+            {
+                // only the first <base href> counts
+                if(attr == "href" && !base_set_)
+                {
+                    try
+                    {
+                        base_ = base_.resolve(clean(unescape(value)));
+                        base_set_ = true;
+                    }
+                    catch(const error&)
+                    {}
+                }
+                continue;
+            }
+            link_(value, name);
+        }
+        else if(attr == "srcset")
+        {
+            // "url [descriptor], url [descriptor], ..."
+            std::string list = unescape(value);
+            size_t i = 0;
+            while(i < list.size())
+            {
+                while(i < list.size() && (space(list[i]) || list[i] == ','))
+                    ++i;
+                size_t start = i;
+                while(i < list.size() && !space(list[i]))
+                    ++i;
+                std::string candidate = list.substr(start, i - start);
+                while(!candidate.empty() && candidate.back() == ',')
+                    candidate.pop_back();
+                if(!candidate.empty())
+                    link_(candidate, name);
+                while(i < list.size() && list[i] != ',')
+                    ++i;
+            }
+        }
+    }
+
+    if(!self_closing && (name == "script" || name == "style"))
+    {
+        end_tag_ = "/" + name;
+        state_ = in_raw;
+    }
+}
+
+void link_extractor::link_(const std::string& value, const std::string& tag)
+{
+    std::string ref = clean(unescape(value));
+    if(ref.empty())
+        return;
+
+    std::string resolved;
+    try
+    {
+        resolved = base_.resolve(ref).str();
+    }
+    catch(const error&)
+    {
+        return;
+    }
+
+    ++links_;
+    cb_(resolved, tag);
+}
+
+}
@@ -0,0 +1,84 @@
+/*
+ * link_extractor.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_LINK_EXTRACTOR_H
+#define CURLPP_LINK_EXTRACTOR_H
+
+#include "curl++.h"
+#include <functional>
+#include <string>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Sink reporting the links of an HTML document while it downloads.
+//
+// href, src and srcset attribute values are resolved against the document
+// URL (or its <base href>) and passed to the callback together with the
+// lower-case tag name as soon as their tag is complete. Text between tags
+// is skipped with memchr, which glibc vectorizes; only the tags themselves
+// are copied, so memory use does not depend on the size of the document.
+// Comments and the content of <script> and <style> elements are ignored.
+// Values that fail to resolve, e.g. "javascript:" URLs, are dropped.
+class link_extractor
+    : public sink
+{
+public:
+    typedef std::function<void(const std::string& url, const std::string& tag)> link_callback;
+
+    link_extractor(const std::string& base, link_callback cb);
+
+    virtual void write(const char * data, size_t size);
+    virtual void finish();
+
+    // number of links reported so far
+    inline size_t links() const
+    { return links_; }
+
+private:
+    enum state_
+    {
+        in_text,
+        in_tag,
+        in_comment,
+        in_raw,         // content of <script> or <style>
+        in_raw_end,     // possible start of its end tag
+    };
+
+    url base_;
+    bool base_set_;
+    link_callback cb_;
+    state_ state_;
+    std::string tag_;       // text between '<' and '>'
+    char quote_;
+    bool value_;            // after '=', where quotes start a value
+    unsigned int dashes_;
+    std::string end_tag_;   // "/script" or "/style" while in raw text
+    size_t matched_;
+    size_t links_;
+
+    void tag_done_();
+    void link_(const std::string& value, const std::string& tag);
+};
+
+}
+
+#endif /* CURLPP_LINK_EXTRACTOR_H */
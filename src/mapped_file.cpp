@@ -0,0 +1,93 @@
+/*
+ * mapped_file.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mapped_file.h"
+#include "curl++.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+mapped_file::mapped_file(const std::string& path)
+    : data_(nullptr)
+    , size_(0)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        throw ERROR("Failed to open file for mapping");
+
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        close(fd);
+        throw ERROR("Failed to stat file for mapping");
+    }
+
+    // mmap refuses zero-length mappings; an empty file maps to nothing
+    size_ = st.st_size;
+    if(size_)
+    {
+        void * addr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        if(addr == MAP_FAILED)
+        {
+            close(fd);
+            throw ERROR("Failed to map file");
+        }
+        data_ = static_cast<const char *>(addr);
+    }
+    close(fd);
+}
+
+mapped_file::mapped_file(mapped_file&& other)
+    : data_(other.data_)
+    , size_(other.size_)
+{
+    other.data_ = nullptr;
+    other.size_ = 0;
+}
+
+mapped_file& mapped_file::operator = (mapped_file&& other)
+{
+    swap(other);
+    return *this;
+}
+
+mapped_file::~mapped_file()
+{
+    if(data_)
+        munmap(const_cast<char *>(data_), size_);
+}
+
+void mapped_file::sequential() const
+{
+    if(data_)
+        madvise(const_cast<char *>(data_), size_, MADV_SEQUENTIAL);
+}
+
+}
+
+#undef ERROR
@@ -0,0 +1,69 @@
+/*
+ * mapped_file.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_MAPPED_FILE_H
+#define CURLPP_MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// read-only memory mapping of a whole file (POSIX mmap)
+class mapped_file
+{
+public:
+    explicit mapped_file(const std::string& path);
+    ~mapped_file();
+
+    mapped_file(const mapped_file& other) = delete;
+    mapped_file(mapped_file&& other);
+    mapped_file& operator = (const mapped_file& other) = delete;
+    mapped_file& operator = (mapped_file&& other);
+
+    inline const char * data() const
+    { return data_; }
+
+    inline size_t size() const
+    { return size_; }
+
+    // hint that the mapping is read front to back
+    void sequential() const;
+
+    inline void swap(mapped_file& other)
+    {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+    }
+
+private:
+    const char * data_;
+    size_t size_;
+};
+
+inline void swap(mapped_file& lhs, mapped_file& rhs)
+{ lhs.swap(rhs); }
+
+}
+
+#endif /* CURLPP_MAPPED_FILE_H */
@@ -0,0 +1,406 @@
+/*
+ * pipeline.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pipeline.h"
+#include <algorithm>
+#include <deque>
+#include <cstring>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+chunk::chunk(size_t capacity)
+    : buf_(new char[capacity])
+    , size_(0)
+    , capacity_(capacity)
+{}
+
+void chunk::resize(size_t size)
+{
+    if(size > capacity_)
+        throw ERROR("chunk size exceeds capacity");
+    size_ = size;
+}
+
+void chunk_releaser::operator () (chunk * c) const
+{
+    pool->release_(c);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+chunk_pool::chunk_pool(size_t chunk_size, size_t max_idle)
+    : chunk_size_(chunk_size)
+    , max_idle_(max_idle)
+{}
+
+chunk_pool::~chunk_pool()
+{
+    for(chunk * c : idle_)
+        delete c;
+}
+
+chunk_ptr chunk_pool::acquire()
+{
+    chunk * c = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(!idle_.empty())
+        {
+            c = idle_.back();
+            idle_.pop_back();
+        }
+    }
+
+    if(c == nullptr)
+        c = new chunk(chunk_size_);
+    c->resize(0);
+    return chunk_ptr(c, chunk_releaser{this});
+}
+
+void chunk_pool::release_(chunk * c)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(idle_.size() < max_idle_)
+        {
+            idle_.push_back(c);
+            return;
+        }
+    }
+    delete c;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+emitter::~emitter()
+{}
+
+stage::~stage()
+{}
+
+void stage::flush(emitter&)
+{}
+
+function_stage::function_stage(function fn)
+    : fn_(std::move(fn))
+{}
+
+void function_stage::process(chunk_ptr c, emitter& out)
+{
+    fn_(std::move(c), out);
+}
+
+sink_stage::sink_stage(sink& out)
+    : out_(out)
+{}
+
+void sink_stage::process(chunk_ptr c, emitter&)
+{
+    out_.write(c->data(), c->size());
+}
+
+void sink_stage::flush(emitter&)
+{
+    out_.finish();
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// bounded single-producer/single-consumer queue between two stages
+class pipeline::queue_
+{
+public:
+    explicit queue_(size_t capacity)
+        : capacity_(capacity)
+        , closed_(false)
+    {}
+
+    // blocks while the queue is full
+    void push(chunk_ptr c)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this]{ return items_.size() < capacity_; });
+        items_.push_back(std::move(c));
+        not_empty_.notify_one();
+    }
+
+    // blocks while the queue is empty; returns false once it is closed
+    // and drained
+    bool pop(chunk_ptr& c)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this]{ return !items_.empty() || closed_; });
+        if(items_.empty())
+            return false;
+        c = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_one();
+    }
+
+    void reopen()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = false;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+    std::deque<chunk_ptr> items_;
+    size_t capacity_;
+    bool closed_;
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// a stage together with its queue and thread, acting as the emitter that
+// feeds the following node
+class pipeline::node_
+    : public emitter
+{
+public:
+    node_(pipeline& owner, std::unique_ptr<stage> s, bool threaded)
+        : owner_(owner)
+        , stage_(std::move(s))
+        , next_(nullptr)
+        , discard_(false)
+    {
+        if(threaded)
+            queue_.reset(new pipeline::queue_(owner.queue_size_));
+    }
+
+    void link(node_ * next)
+    { next_ = next; }
+
+    void start()
+    {
+        exc_ = nullptr;
+        discard_ = false;
+        if(queue_)
+        {
+            queue_->reopen();
+            thread_ = std::thread(&node_::run_, this);
+        }
+    }
+
+    // hand a chunk to this node's stage
+    void push(chunk_ptr c)
+    {
+        if(queue_)
+            queue_->push(std::move(c));
+        else if(!owner_.failed_)
+            stage_->process(std::move(c), *this);
+    }
+
+    // Flush this stage and all following ones. With `discard` set, queued
+    // chunks are dropped and stages are not flushed.
+    void finish(bool discard)
+    {
+        if(queue_)
+        {
+            discard_ = discard;
+            queue_->close();
+            thread_.join();
+            return;
+        }
+
+        if(!discard && !owner_.failed_)
+            stage_->flush(*this);
+        if(next_)
+            next_->finish(discard);
+    }
+
+    std::exception_ptr exception() const
+    { return exc_; }
+
+    virtual void emit(chunk_ptr c)
+    {
+        if(next_)
+            next_->push(std::move(c));
+    }
+
+    virtual chunk_ptr acquire()
+    { return owner_.pool_.acquire(); }
+
+private:
+    pipeline& owner_;
+    std::unique_ptr<stage> stage_;
+    std::unique_ptr<pipeline::queue_> queue_;
+    std::thread thread_;
+    std::exception_ptr exc_;
+    node_ * next_;
+    std::atomic<bool> discard_;
+
+    void run_()
+    {
+        chunk_ptr c;
+        while(queue_->pop(c))
+        {
+            // keep draining after an error so the producer never blocks
+            if(discard_ || owner_.failed_)
+                continue;
+            try
+            {
+                stage_->process(std::move(c), *this);
+            }
+            catch(...)
+            {
+                exc_ = std::current_exception();
+                owner_.failed_ = true;
+            }
+            c.reset();
+        }
+
+        bool discard = discard_ || owner_.failed_;
+        if(!discard)
+        {
+            try
+            {
+                stage_->flush(*this);
+            }
+            catch(...)
+            {
+                exc_ = std::current_exception();
+                owner_.failed_ = true;
+                discard = true;
+            }
+        }
+        if(next_)
+            next_->finish(discard);
+    }
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+pipeline::pipeline(size_t chunk_size, size_t queue_size)
+    : pool_(chunk_size, queue_size * 4)
+    , queue_size_(std::max<size_t>(queue_size, 1))
+    , failed_(false)
+    , started_(false)
+{}
+
+pipeline::~pipeline()
+{
+    if(started_)
+        stop_(true);
+}
+
+pipeline& pipeline::add(std::unique_ptr<stage> s, bool threaded)
+{
+    if(started_)
+        throw ERROR("Cannot add stages to a running pipeline");
+
+    nodes_.emplace_back(new node_(*this, std::move(s), threaded));
+    if(nodes_.size() > 1)
+        nodes_[nodes_.size()-2]->link(nodes_.back().get());
+    return *this;
+}
+
+pipeline& pipeline::add(function_stage::function fn, bool threaded)
+{
+    return add(std::unique_ptr<stage>(new function_stage(std::move(fn))),
+               threaded);
+}
+
+void pipeline::write(const char * data, size_t size)
+{
+    if(!started_)
+        start_();
+
+    if(failed_)
+    {
+        // a threaded stage failed; stop everything and report its error
+        finish();
+        return;
+    }
+
+    if(nodes_.empty())
+        return;
+
+    try
+    {
+        while(size)
+        {
+            chunk_ptr c = pool_.acquire();
+            size_t len = std::min(size, c->capacity());
+            memcpy(c->data(), data, len);
+            c->resize(len);
+            nodes_.front()->push(std::move(c));
+
+            data += len;
+            size -= len;
+        }
+    }
+    catch(...)
+    {
+        // an inline stage threw; tear down threaded stages before unwinding
+        failed_ = true;
+        stop_(true);
+        throw;
+    }
+}
+
+void pipeline::finish()
+{
+    if(!started_)
+        start_();
+    stop_(false);
+
+    for(auto&& n : nodes_)
+        if(n->exception())
+            std::rethrow_exception(n->exception());
+}
+
+void pipeline::start_()
+{
+    failed_ = false;
+    for(auto&& n : nodes_)
+        n->start();
+    started_ = true;
+}
+
+void pipeline::stop_(bool discard)
+{
+    started_ = false;
+    if(!nodes_.empty())
+        nodes_.front()->finish(discard);
+}
+
+}
+
+#undef ERROR
@@ -0,0 +1,215 @@
+/*
+ * pipeline.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CURLPP_PIPELINE_H
+#define CURLPP_PIPELINE_H
+
+#include "curl++.h"
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace curl
+{
+
+class chunk_pool;
+
+////////////////////////////////////////////////////////////////////////////////
+// fixed-capacity byte buffer handed from stage to stage
+class chunk
+{
+public:
+    explicit chunk(size_t capacity);
+
+    chunk(const chunk& other) = delete;
+    chunk& operator = (const chunk& other) = delete;
+
+    inline char * data()
+    { return buf_.get(); }
+
+    inline const char * data() const
+    { return buf_.get(); }
+
+    inline size_t size() const
+    { return size_; }
+
+    inline size_t capacity() const
+    { return capacity_; }
+
+    void resize(size_t size);
+
+private:
+    std::unique_ptr<char[]> buf_;
+    size_t size_;
+    size_t capacity_;
+};
+
+// returns a chunk to the pool it was acquired from instead of freeing it
+struct chunk_releaser
+{
+    chunk_pool * pool;
+    void operator () (chunk * c) const;
+};
+
+typedef std::unique_ptr<chunk, chunk_releaser> chunk_ptr;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// free-list of equally sized chunks
+class chunk_pool
+{
+public:
+    explicit chunk_pool(size_t chunk_size = 64 * 1024, size_t max_idle = 64);
+    ~chunk_pool();
+
+    chunk_pool(const chunk_pool& other) = delete;
+    chunk_pool& operator = (const chunk_pool& other) = delete;
+
+    chunk_ptr acquire();
+
+    inline size_t chunk_size() const
+    { return chunk_size_; }
+
+private:
+    friend struct chunk_releaser;
+
+    std::mutex mutex_;
+    std::vector<chunk *> idle_;
+    size_t chunk_size_;
+    size_t max_idle_;
+
+    void release_(chunk * c);
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// passes chunks on to the next stage of a pipeline
+class emitter
+{
+public:
+    virtual ~emitter();
+
+    virtual void emit(chunk_ptr c) = 0;
+
+    // get an empty chunk from the pipeline's pool
+    virtual chunk_ptr acquire() = 0;
+
+    inline void operator () (chunk_ptr c)
+    { emit(std::move(c)); }
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// single step of a pipeline, e.g. decode, decompress, hash, parse or store
+class stage
+{
+public:
+    virtual ~stage();
+
+    // Takes ownership of `c`. A stage either passes `c` (possibly modified
+    // in place) on through `out`, emits new chunks, or simply drops it.
+    virtual void process(chunk_ptr c, emitter& out) = 0;
+
+    // called once after the last chunk; emit anything still buffered
+    virtual void flush(emitter& out);
+};
+
+// stage calling a function object for each chunk
+class function_stage
+    : public stage
+{
+public:
+    typedef std::function<void(chunk_ptr, emitter&)> function;
+
+    explicit function_stage(function fn);
+
+    virtual void process(chunk_ptr c, emitter& out);
+
+private:
+    function fn_;
+};
+
+// terminal stage writing every chunk to a sink
+class sink_stage
+    : public stage
+{
+public:
+    explicit sink_stage(sink& out);
+
+    virtual void process(chunk_ptr c, emitter& out);
+    virtual void flush(emitter& out);
+
+private:
+    sink& out_;
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Chain of stages fed by easy::recv_into.
+//
+// The data libcurl hands to the write callback is copied once into a pooled
+// chunk; from there on chunks are moved between stages and returned to the
+// pool when the last stage drops them. Stages added with `threaded = true`
+// run on their own thread behind a bounded queue of `queue_size` chunks,
+// which also bounds the pipeline's memory use.
+class pipeline
+    : public sink
+{
+public:
+    explicit pipeline(size_t chunk_size = 64 * 1024, size_t queue_size = 16);
+    ~pipeline();
+
+    pipeline(const pipeline& other) = delete;
+    pipeline& operator = (const pipeline& other) = delete;
+
+    pipeline& add(std::unique_ptr<stage> s, bool threaded = false);
+    pipeline& add(function_stage::function fn, bool threaded = false);
+
+    virtual void write(const char * data, size_t size);
+
+    // flush all stages and wait for threaded stages to drain; rethrows the
+    // first exception raised by any stage
+    virtual void finish();
+
+private:
+    class queue_;
+    class node_;
+
+    chunk_pool pool_;
+    size_t queue_size_;
+    std::vector<std::unique_ptr<node_>> nodes_;
+    std::atomic<bool> failed_;
+    bool started_;
+
+    void start_();
+    void stop_(bool discard);
+};
+
+}
+
+#endif /* CURLPP_PIPELINE_H */
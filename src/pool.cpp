@@ -0,0 +1,259 @@
+/*
+ * pool.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "pool.h"
+#include <algorithm>
+
+namespace curl
+{
+
+namespace
+{
+    // weight of the newest sample in the running averages
+    constexpr double weight = 0.25;
+
+    // amount of data the receive buffer should hold at the measured rate;
+    // about one write callback every few milliseconds on a saturated link
+    constexpr double fill_time = 0.005;
+
+    constexpr long recv_min   = 1024;
+    constexpr long recv_max   = 1024 * 1024;
+    constexpr long upload_min = 16 * 1024;
+    constexpr long upload_max = 2 * 1024 * 1024;
+
+    long round_pow2(double value, long lo, long hi)
+    {
+        long size = lo;
+        while(size < value && size < hi)
+            size *= 2;
+        return size;
+    }
+
+    long buffer_size(double bytes, double rate, long lo, long hi)
+    {
+        // never larger than what a typical transfer to this origin moves
+        long by_rate = round_pow2(rate * fill_time, lo, hi);
+        long by_size = round_pow2(bytes, lo, hi);
+        return std::min(by_rate, by_size);
+    }
+
+    // easy::info without the exception, so that a handle which cannot be
+    // measured is still checked back in
+    template <typename T>
+    T info_or_zero(easy& handle, CURLINFO info)
+    {
+        T value = T();
+        if(curl_easy_getinfo(handle.handle(), info, &value) != CURLE_OK)
+            return T();
+        return value;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+pool::pool(size_t max_idle_per_origin, bool autotune)
+    : max_idle_(max_idle_per_origin)
+    , autotune_(autotune)
+{}
+
+pool::~pool()
+{}
+
+pool::lease pool::acquire(const std::string& address)
+{
+    std::string origin = url(address).origin();
+    std::vector<easy> found;
+    buffer_sizes sizes = {0, 0};
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        origin_& o = origins_[origin];
+        if(!o.idle.empty())
+        {
+            found.push_back(std::move(o.idle.back()));
+            o.idle.pop_back();
+            o.idle_since.pop_back();
+        }
+        ++o.checked_out;
+        if(autotune_ && o.samples)
+            sizes = compute_(o);
+    }
+
+    easy handle = found.empty() ? easy() : std::move(found.back());
+
+    if(sizes.recv)
+        handle.set(CURLOPT_BUFFERSIZE, sizes.recv);
+    if(sizes.upload)
+        handle.set(CURLOPT_UPLOAD_BUFFERSIZE, sizes.upload);
+    handle.set(CURLOPT_URL, address);
+
+    return lease(*this, std::move(origin), std::move(handle));
+}
+
+pool::buffer_sizes pool::tuned(const std::string& origin) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = origins_.find(origin);
+    if(it == origins_.end() || !it->second.samples)
+        return buffer_sizes{0, 0};
+    return compute_(it->second);
+}
+
+std::vector<pool::origin_stats> pool::stats() const
+{
+    std::vector<origin_stats> result;
+    clock::time_point now = clock::now();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    result.reserve(origins_.size());
+    for(auto&& entry : origins_)
+    {
+        const origin_& o = entry.second;
+        origin_stats st;
+        st.origin      = entry.first;
+        st.checked_out = o.checked_out;
+        st.idle        = o.idle.size();
+        st.age         = std::chrono::duration<double>(now - o.created).count();
+        st.oldest_idle = o.idle_since.empty() ? 0.0 :
+            std::chrono::duration<double>(now - o.idle_since.front()).count();
+        st.transfers   = o.transfers;
+        st.connects    = o.connects;
+        st.reused      = o.reused;
+        st.http1       = o.http[0];
+        st.http2       = o.http[1];
+        st.http3       = o.http[2];
+        st.buffers     = autotune_ && o.samples ? compute_(o) : buffer_sizes{0, 0};
+        result.push_back(std::move(st));
+    }
+    return result;
+}
+
+void pool::release_(const std::string& origin, easy&& handle, bool track)
+{
+    double secs = info_or_zero<curl_off_t>(handle, CURLINFO_TOTAL_TIME_T) / 1e6;
+    long status = info_or_zero<long>(handle, CURLINFO_RESPONSE_CODE);
+    long connects = info_or_zero<long>(handle, CURLINFO_NUM_CONNECTS);
+    long version = info_or_zero<long>(handle, CURLINFO_HTTP_VERSION);
+    curl_off_t down = 0, up = 0;
+    curl_off_t down_rate = 0, up_rate = 0;
+
+    if(autotune_ && track)
+    {
+        down      = info_or_zero<curl_off_t>(handle, CURLINFO_SIZE_DOWNLOAD_T);
+        up        = info_or_zero<curl_off_t>(handle, CURLINFO_SIZE_UPLOAD_T);
+        down_rate = info_or_zero<curl_off_t>(handle, CURLINFO_SPEED_DOWNLOAD_T);
+        up_rate   = info_or_zero<curl_off_t>(handle, CURLINFO_SPEED_UPLOAD_T);
+    }
+
+    // drop options set by the last user, but keep the connection cache
+    handle.reset();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    origin_& o = origins_[origin];
+    --o.checked_out;
+
+    // failed connection attempts report no new connection either, so only
+    // count transfers that got as far as a response
+    if(track && status != 0)
+    {
+        ++o.transfers;
+        o.connects += connects;
+        if(connects == 0)
+            ++o.reused;
+
+        switch(version)
+        {
+        case CURL_HTTP_VERSION_1_0:
+        case CURL_HTTP_VERSION_1_1: ++o.http[0]; break;
+        case CURL_HTTP_VERSION_2_0: ++o.http[1]; break;
+        case CURL_HTTP_VERSION_3:   ++o.http[2]; break;
+        }
+    }
+
+    if(autotune_ && track && secs > 0.0)
+    {
+        if(o.samples++ == 0)
+        {
+            o.down_bytes = down;
+            o.down_rate  = down_rate;
+            o.up_bytes   = up;
+            o.up_rate    = up_rate;
+        }
+        else
+        {
+            o.down_bytes += weight * (down      - o.down_bytes);
+            o.down_rate  += weight * (down_rate - o.down_rate);
+            o.up_bytes   += weight * (up        - o.up_bytes);
+            o.up_rate    += weight * (up_rate   - o.up_rate);
+        }
+    }
+
+    if(o.idle.size() < max_idle_)
+    {
+        o.idle.push_back(std::move(handle));
+        o.idle_since.push_back(clock::now());
+    }
+}
+
+pool::buffer_sizes pool::compute_(const origin_& o)
+{
+    buffer_sizes sizes = {0, 0};
+    if(o.down_bytes > 0)
+        sizes.recv = buffer_size(o.down_bytes, o.down_rate,
+                                 recv_min, recv_max);
+    if(o.up_bytes > 0)
+        sizes.upload = buffer_size(o.up_bytes, o.up_rate,
+                                   upload_min, upload_max);
+    return sizes;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+pool::lease::lease(pool& owner, std::string origin, easy&& handle)
+    : pool_(&owner)
+    , origin_(std::move(origin))
+    , handle_(std::move(handle))
+    , track_(true)
+{}
+
+pool::lease::lease(lease&& other)
+    : pool_(other.pool_)
+    , origin_(std::move(other.origin_))
+    , handle_(std::move(other.handle_))
+    , track_(other.track_)
+{
+    other.pool_ = nullptr;
+}
+
+pool::lease::~lease()
+{
+    if(pool_ == nullptr)
+        return;
+
+    // release_ only throws when out of memory; the handle is dropped then
+    try
+    {
+        pool_->release_(origin_, std::move(handle_), track_);
+    }
+    catch(...)
+    {}
+}
+
+}
@@ -0,0 +1,166 @@
+/*
+ * pool.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_POOL_H
+#define CURLPP_POOL_H
+
+#include "curl++.h"
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Per-origin pool of easy handles.
+//
+// Idle handles keep their connection cache, so a handle acquired for an
+// origin it has talked to before can reuse the open connection. When a
+// lease is returned, the pool looks at the transfer's size and throughput
+// and derives CURLOPT_BUFFERSIZE/CURLOPT_UPLOAD_BUFFERSIZE for the next
+// handle it hands out for that origin: bulk transfers on fast links get
+// large buffers (fewer write callbacks), small responses get small ones.
+//
+// The pool also keeps per-origin counters on handle and connection reuse,
+// see `stats`.
+class pool
+{
+public:
+    class lease;
+
+    struct buffer_sizes
+    {
+        long recv;      // 0 means libcurl's default
+        long upload;
+    };
+
+    // Snapshot of one origin. libcurl does not expose its connection cache,
+    // so connection reuse is derived from CURLINFO_NUM_CONNECTS of each
+    // finished transfer: a transfer that needed no new connection reused one
+    // kept open by its handle.
+    struct origin_stats
+    {
+        std::string origin;
+        size_t checked_out;         // leases currently held
+        size_t idle;                // handles waiting in the pool
+        double age;                 // seconds since first use of the origin
+        double oldest_idle;         // seconds the longest idle handle waited
+        unsigned long transfers;
+        unsigned long connects;     // new connections (TCP and, for https, TLS handshakes)
+        unsigned long reused;       // transfers served on an existing connection
+        unsigned long http1;        // transfers per negotiated HTTP version
+        unsigned long http2;
+        unsigned long http3;
+        buffer_sizes buffers;
+    };
+
+    explicit pool(size_t max_idle_per_origin = 4, bool autotune = true);
+    ~pool();
+
+    pool(const pool& other) = delete;
+    pool& operator = (const pool& other) = delete;
+
+    // get a handle for `address` with CURLOPT_URL and tuned buffer sizes set
+    lease acquire(const std::string& address);
+
+    // buffer sizes currently chosen for `origin` ("scheme://host:port")
+    buffer_sizes tuned(const std::string& origin) const;
+
+    // one entry per origin seen so far; only takes the pool's lock for the
+    // time it takes to copy the counters
+    std::vector<origin_stats> stats() const;
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct origin_
+    {
+        std::vector<easy> idle;
+        std::vector<clock::time_point> idle_since;
+        double down_bytes = 0;  // exponentially weighted averages
+        double down_rate = 0;   // in bytes/s
+        double up_bytes = 0;
+        double up_rate = 0;
+        unsigned long samples = 0;
+
+        clock::time_point created = clock::now();
+        size_t checked_out = 0;
+        unsigned long transfers = 0;
+        unsigned long connects = 0;
+        unsigned long reused = 0;
+        unsigned long http[3] = {0, 0, 0};
+    };
+
+    mutable std::mutex mutex_;
+    std::map<std::string, origin_> origins_;
+    size_t max_idle_;
+    bool autotune_;
+
+    void release_(const std::string& origin, easy&& handle, bool track);
+    static buffer_sizes compute_(const origin_& o);
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// RAII handle checked out of a pool; resets the handle and returns it on
+// destruction
+class pool::lease
+{
+public:
+    lease(lease&& other);
+    ~lease();
+
+    lease(const lease& other) = delete;
+    lease& operator = (const lease& other) = delete;
+    lease& operator = (lease&& other) = delete;
+
+    inline easy& operator * ()
+    { return handle_; }
+
+    inline easy * operator -> ()
+    { return &handle_; }
+
+    inline const std::string& origin() const
+    { return origin_; }
+
+    // keep the transfer out of the origin's statistics and buffer tuning,
+    // e.g. for health probes whose tiny responses say nothing about the
+    // real traffic
+    inline void untracked()
+    { track_ = false; }
+
+private:
+    friend class pool;
+
+    lease(pool& owner, std::string origin, easy&& handle);
+
+    pool * pool_;
+    std::string origin_;
+    easy handle_;
+    bool track_;
+};
+
+}
+
+#endif /* CURLPP_POOL_H */
@@ -0,0 +1,199 @@
+/*
+ * probe.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "probe.h"
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+namespace curl
+{
+
+struct prober::probe_
+{
+    std::string address;
+    bool ranged;
+    bool cut_off;               // refused the body of a 200 to a range request
+    curl_off_t received;
+    curl_off_t range_size;      // total from Content-Range
+    std::string etag;
+};
+
+namespace
+{
+    // "scheme://authority" without the overhead of a full parse
+    std::string origin_of(const std::string& address)
+    {
+        size_t start = address.find("://");
+        start = start == std::string::npos ? 0 : start + 3;
+        return address.substr(0, address.find_first_of("/?#", start));
+    }
+
+    // value of header line `line` if it is called `name`, trimmed
+    bool header_value(const char * line, size_t len, const char * name, std::string& value)
+    {
+        size_t n = strlen(name);
+        if(len <= n || line[n] != ':' || strncasecmp(line, name, n) != 0)
+            return false;
+
+        const char * begin = line + n + 1;
+        const char * end = line + len;
+        while(begin < end && (*begin == ' ' || *begin == '\t'))
+            ++begin;
+        while(end > begin && (end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' ' || end[-1] == '\t'))
+            --end;
+        value.assign(begin, end);
+        return true;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+prober::prober(pool& handles)
+    : prober(handles, options())
+{}
+
+prober::prober(pool& handles, options opts)
+    : opts_(opts)
+    , executor_(handles, opts.max_active)
+{}
+
+void prober::add(const std::string& address)
+{
+    start_(address, !no_head_.empty() && no_head_.count(origin_of(address)));
+}
+
+void prober::run(callback done, source feed)
+{
+    done_ = std::move(done);
+
+    executor::source pull;
+    if(feed)
+        pull = [this, &feed](executor&, size_t room) {
+            std::string address;
+            while(room--)
+            {
+                if(!feed(address))
+                    return false;
+                add(address);
+            }
+            return true;
+        };
+    executor_.run(pull);
+}
+
+void prober::start_(const std::string& address, bool ranged)
+{
+    std::shared_ptr<probe_> p(new probe_{address, ranged, false, 0, -1, std::string()});
+
+    executor_.add(address,
+        [this, p](easy& handle) {
+            handle.set(CURLOPT_HEADERFUNCTION, prober::header_);
+            handle.set(CURLOPT_HEADERDATA, static_cast<void *>(p.get()));
+            handle.set(CURLOPT_WRITEFUNCTION, prober::write_);
+            handle.set(CURLOPT_WRITEDATA, static_cast<void *>(p.get()));
+            if(p->ranged)
+                handle.set(CURLOPT_RANGE, std::string("0-0"));
+            else
+                handle.set(CURLOPT_NOBODY, 1L);
+
+            handle.set(CURLOPT_FILETIME, 1L);
+            handle.set(CURLOPT_PIPEWAIT, 1L);
+            handle.set(CURLOPT_HTTP_VERSION, static_cast<long>(CURL_HTTP_VERSION_2TLS));
+            handle.set(CURLOPT_FOLLOWLOCATION, opts_.follow_redirects ? 1L : 0L);
+            handle.set(CURLOPT_TIMEOUT_MS, opts_.timeout);
+        },
+        [this, p](easy& handle, CURLcode result) {
+            finish_(*p, handle, result);
+        });
+}
+
+void prober::finish_(probe_& p, easy& handle, CURLcode result)
+{
+    probe_result r;
+    r.result = p.cut_off && result == CURLE_WRITE_ERROR ? CURLE_OK : result;
+    r.status = handle.info<long>(CURLINFO_RESPONSE_CODE);
+    r.ranged = p.ranged;
+
+    if(!p.ranged && opts_.range_fallback && (r.status == 405 || r.status == 501))
+    {
+        no_head_.insert(origin_of(p.address));
+        start_(p.address, true);
+        return;
+    }
+
+    r.exists = r.result == CURLE_OK
+        && ((r.status >= 200 && r.status < 300) || (p.ranged && r.status == 416));
+
+    // a 206 or 416 carries the size in Content-Range; anything else in
+    // Content-Length
+    if(p.ranged && (r.status == 206 || r.status == 416))
+        r.size = p.range_size;
+    else
+        r.size = handle.info<curl_off_t>(CURLINFO_CONTENT_LENGTH_DOWNLOAD_T);
+
+    r.last_modified = static_cast<time_t>(handle.info<curl_off_t>(CURLINFO_FILETIME_T));
+    r.etag.swap(p.etag);
+
+    if(done_)
+        done_(p.address, r);
+}
+
+size_t prober::header_(char * data, size_t size, size_t nmemb, void * arg)
+{
+    probe_ * p = static_cast<probe_ *>(arg);
+    size_t len = size * nmemb;
+
+    // a new status line starts the headers of a redirect target or of the
+    // final response after an interim one
+    if(len > 5 && memcmp(data, "HTTP/", 5) == 0)
+    {
+        p->etag.clear();
+        p->range_size = -1;
+        return len;
+    }
+
+    std::string value;
+    if(header_value(data, len, "etag", value))
+        p->etag.swap(value);
+    else if(header_value(data, len, "content-range", value))
+    {
+        // "bytes 0-0/1234" or "bytes */1234"
+        size_t slash = value.rfind('/');
+        if(slash != std::string::npos && value.compare(slash + 1, std::string::npos, "*") != 0)
+            p->range_size = strtoll(value.c_str() + slash + 1, nullptr, 10);
+    }
+    return len;
+}
+
+size_t prober::write_(char *, size_t size, size_t nmemb, void * arg)
+{
+    // a range probe gets at most one byte; more means the range was ignored
+    probe_ * p = static_cast<probe_ *>(arg);
+    p->received += size * nmemb;
+    if(p->received > 1)
+    {
+        p->cut_off = true;
+        return 0;
+    }
+    return size * nmemb;
+}
+
+}
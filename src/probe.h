@@ -0,0 +1,103 @@
+/*
+ * probe.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CURLPP_PROBE_H
+#define CURLPP_PROBE_H
+
+#include "executor.h"
+#include <ctime>
+#include <set>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// what a probe found out about one URL
+struct probe_result
+{
+    CURLcode result;
+    long status;                // final HTTP response code, 0 if there was none
+    bool exists;
+    bool ranged;                // answered by the Range fallback instead of HEAD
+    curl_off_t size;            // -1 if unknown
+    time_t last_modified;       // -1 if unknown
+    std::string etag;           // as sent, including quotes and W/
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Checks existence, size, ETag and Last-Modified of many URLs.
+//
+// Each URL gets a HEAD request. Origins answering HEAD with 405 or 501 are
+// remembered, and their URLs are probed with "Range: bytes=0-0" instead; a
+// server that ignores the range is cut off after the response headers.
+// Response headers are parsed as they arrive and bodies are never stored,
+// so a probe costs little more than its result.
+//
+// Transfers run on an executor, so handles and their connections are reused
+// per origin, and with CURLOPT_PIPEWAIT set concurrent probes to an HTTP/2
+// origin share one multiplexed connection instead of opening new ones.
+class prober
+{
+public:
+    struct options
+    {
+        size_t max_active = 256;
+        long timeout = 30000;           // per probe, in milliseconds
+        bool follow_redirects = true;
+        bool range_fallback = true;
+    };
+
+    typedef std::function<void(const std::string& address, const probe_result& r)> callback;
+
+    // stores the next URL in `address`; returns false once there are none
+    typedef std::function<bool(std::string& address)> source;
+
+    explicit prober(pool& handles);
+    prober(pool& handles, options opts);
+
+    prober(const prober& other) = delete;
+    prober& operator = (const prober& other) = delete;
+
+    void add(const std::string& address);
+
+    // Probe all added URLs and those `feed` yields, calling `done` for each
+    // as it finishes. URLs are pulled from `feed` only when there is room,
+    // so it can stream very large lists.
+    void run(callback done, source feed = source());
+
+private:
+    struct probe_;
+
+    options opts_;
+    executor executor_;
+    callback done_;
+    std::set<std::string> no_head_;     // origins that refuse HEAD
+
+    void start_(const std::string& address, bool ranged);
+    void finish_(probe_& p, easy& handle, CURLcode result);
+
+    static size_t header_(char *, size_t, size_t, void *);
+    static size_t write_(char *, size_t, size_t, void *);
+};
+
+}
+
+#endif /* CURLPP_PROBE_H */
@@ -0,0 +1,185 @@
+/*
+ * resumable_upload.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "resumable_upload.h"
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+namespace
+{
+    const char * const tus_version = "Tus-Resumable: 1.0.0";
+
+    size_t discard(char *, size_t size, size_t nmemb, void *)
+    {
+        return size*nmemb;
+    }
+
+    void expect_status(easy& handle, long expected, const char * msg)
+    {
+        if(handle.info<long>(CURLINFO_RESPONSE_CODE) != expected)
+            throw ERROR(msg);
+    }
+
+    curl_off_t upload_offset(const headers& hdrs)
+    {
+        std::string value = hdrs.get("Upload-Offset");
+        if(value.empty())
+            throw ERROR("Response without Upload-Offset");
+        return strtoll(value.c_str(), nullptr, 10);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+resumable_upload::resumable_upload(pool& handles, std::string endpoint,
+                                   options opts)
+    : handles_(handles)
+    , endpoint_(std::move(endpoint))
+    , opts_(std::move(opts))
+{}
+
+std::string resumable_upload::upload(const mapped_file& source,
+                                     std::string upload_url)
+{
+    const curl_off_t total = source.size();
+    curl_off_t pos = 0;
+
+    if(upload_url.empty())
+        upload_url = create(total);
+    else
+        pos = offset(upload_url);
+
+    source.sequential();
+
+    // only progress beyond anything confirmed before ends a run of failures,
+    // so a server that keeps losing data cannot keep the loop going
+    unsigned int failures = 0;
+    curl_off_t confirmed = pos;
+    while(pos < total)
+    {
+        size_t len = std::min<curl_off_t>(opts_.chunk_size, total - pos);
+        try
+        {
+            pos = patch_(upload_url, pos, source.data() + pos, len);
+            if(pos > confirmed)
+            {
+                confirmed = pos;
+                failures = 0;
+            }
+            if(opts_.progress)
+                opts_.progress(pos, total);
+        }
+        catch(const error&)
+        {
+            if(++failures > opts_.max_retries)
+                throw;
+
+            // back off, then continue from what the server confirms
+            std::this_thread::sleep_for(opts_.retry_delay * (1 << std::min(failures - 1, 6u)));
+            try
+            {
+                pos = offset(upload_url);
+            }
+            catch(const error&)
+            {}  // keep the old offset; the next PATCH tells
+        }
+    }
+    return upload_url;
+}
+
+std::string resumable_upload::create(curl_off_t length)
+{
+    list hdrs;
+    hdrs += tus_version;
+    hdrs += "Upload-Length: " + std::to_string(length);
+    if(!opts_.metadata.empty())
+        hdrs += "Upload-Metadata: " + opts_.metadata;
+
+    headers response;
+    pool::lease handle = handles_.acquire(endpoint_);
+    handle->set(CURLOPT_HTTPHEADER, *hdrs);
+    handle->set(CURLOPT_POST, 1L);
+    handle->set(CURLOPT_POSTFIELDSIZE, 0L);
+    handle->set(CURLOPT_WRITEFUNCTION, discard);
+    response.attach(*handle);
+    handle->perform();
+    expect_status(*handle, 201, "Failed to create upload");
+
+    std::string location = response.get("Location");
+    if(location.empty())
+        throw ERROR("Upload created without Location");
+
+    // Location may be relative to the endpoint
+    return url(endpoint_).resolve(location).str();
+}
+
+curl_off_t resumable_upload::offset(const std::string& upload_url)
+{
+    list hdrs;
+    hdrs += tus_version;
+
+    headers response;
+    pool::lease handle = handles_.acquire(upload_url);
+    handle->set(CURLOPT_HTTPHEADER, *hdrs);
+    handle->set(CURLOPT_NOBODY, 1L);
+    response.attach(*handle);
+    handle->perform();
+    expect_status(*handle, 200, "Failed to query upload offset");
+    return upload_offset(response);
+}
+
+curl_off_t resumable_upload::patch_(const std::string& upload_url,
+                                    curl_off_t offset,
+                                    const char * data, size_t size)
+{
+    list hdrs;
+    hdrs += tus_version;
+    hdrs += "Content-Type: application/offset+octet-stream";
+    hdrs += "Upload-Offset: " + std::to_string(offset);
+    hdrs += "Expect:";
+
+    // POSTFIELDS does not copy; the chunk is read from the mapping
+    headers response;
+    pool::lease handle = handles_.acquire(upload_url);
+    handle->set(CURLOPT_HTTPHEADER, *hdrs);
+    handle->set(CURLOPT_CUSTOMREQUEST, "PATCH");
+    handle->set(CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(size));
+    handle->set(CURLOPT_POSTFIELDS, data);
+    handle->set(CURLOPT_WRITEFUNCTION, discard);
+    response.attach(*handle);
+    handle->perform();
+    expect_status(*handle, 204, "Failed to upload chunk");
+
+    // a 204 that stored nothing would otherwise be retried forever
+    curl_off_t stored = upload_offset(response);
+    if(stored <= offset || stored > offset + static_cast<curl_off_t>(size))
+        throw ERROR("Upload-Offset did not advance with the chunk");
+    return stored;
+}
+
+}
+
+#undef ERROR
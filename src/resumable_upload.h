@@ -0,0 +1,82 @@
+/*
+ * resumable_upload.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_RESUMABLE_UPLOAD_H
+#define CURLPP_RESUMABLE_UPLOAD_H
+
+#include "mapped_file.h"
+#include "pool.h"
+#include <chrono>
+#include <functional>
+#include <string>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Client for resumable uploads following the tus 1.0 protocol.
+//
+// An upload is created with a POST to the collection endpoint, then sent as
+// a series of PATCH requests, each carrying one chunk straight out of the
+// memory-mapped source. After a failed chunk the client asks the server for
+// the offset it actually stored (HEAD) and continues from there, so only the
+// unconfirmed part of a chunk is sent again.
+class resumable_upload
+{
+public:
+    // called after each confirmed chunk with the server's offset
+    typedef std::function<void(curl_off_t offset, curl_off_t total)> progress_callback;
+
+    struct options
+    {
+        size_t chunk_size = 8 * 1024 * 1024;
+        unsigned int max_retries = 10;      // consecutive failures
+        std::chrono::milliseconds retry_delay = std::chrono::milliseconds(500);
+        std::string metadata;               // Upload-Metadata header value
+        progress_callback progress;
+    };
+
+    resumable_upload(pool& handles, std::string endpoint, options opts);
+
+    resumable_upload(const resumable_upload& other) = delete;
+    resumable_upload& operator = (const resumable_upload& other) = delete;
+
+    // Upload `source`, resuming `upload_url` if given, and return the
+    // upload's URL. Keep the URL to resume after the process restarts.
+    std::string upload(const mapped_file& source, std::string upload_url = "");
+
+    // create an upload of `length` bytes and return its URL
+    std::string create(curl_off_t length);
+
+    // offset the server has stored for `upload_url`
+    curl_off_t offset(const std::string& upload_url);
+
+private:
+    pool& handles_;
+    std::string endpoint_;
+    options opts_;
+
+    curl_off_t patch_(const std::string& upload_url, curl_off_t offset,
+                      const char * data, size_t size);
+};
+
+}
+
+#endif /* CURLPP_RESUMABLE_UPLOAD_H */
@@ -0,0 +1,182 @@
+/*
+ * sockopt.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "sockopt.h"
+#include <algorithm>
+#include <climits>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#endif
+
+namespace curl
+{
+
+namespace
+{
+    constexpr int unset = -1;
+
+    void setopt(curl_socket_t fd, int level, int name, int value)
+    {
+        // best effort; the connection works without any of these
+        setsockopt(fd, level, name,
+                   reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+socket_options::socket_options()
+    : rcvbuf_(unset)
+    , sndbuf_(unset)
+    , nodelay_(unset)
+    , quickack_(unset)
+    , busy_poll_(unset)
+    , notsent_lowat_(unset)
+    , tos_(unset)
+{}
+
+socket_options socket_options::bulk(double bytes_per_sec, double rtt_secs)
+{
+    socket_options opts;
+    opts.buffers_for(bytes_per_sec, rtt_secs)
+        .nodelay(false)                 // libcurl turns Nagle off by default
+        .tos(0x08);                     // IPTOS_THROUGHPUT
+    return opts;
+}
+
+socket_options socket_options::low_latency()
+{
+    socket_options opts;
+    opts.nodelay(true)
+        .quickack(true)
+        .notsent_lowat(16 * 1024)
+        .busy_poll(50)
+        .tos(0x10);                     // IPTOS_LOWDELAY
+    return opts;
+}
+
+socket_options& socket_options::recv_buffer(int bytes)
+{
+    rcvbuf_ = bytes;
+    return *this;
+}
+
+socket_options& socket_options::send_buffer(int bytes)
+{
+    sndbuf_ = bytes;
+    return *this;
+}
+
+socket_options& socket_options::buffers_for(double bytes_per_sec, double rtt_secs)
+{
+    // twice the BDP leaves room for the kernel's bookkeeping overhead, which
+    // it accounts against the same buffer
+    double bdp = 2.0 * bytes_per_sec * rtt_secs;
+    int bytes = static_cast<int>(std::min(std::max(bdp, 64.0 * 1024), double(INT_MAX)));
+    rcvbuf_ = bytes;
+    sndbuf_ = bytes;
+    return *this;
+}
+
+socket_options& socket_options::nodelay(bool enable)
+{
+    nodelay_ = enable;
+    return *this;
+}
+
+socket_options& socket_options::quickack(bool enable)
+{
+    quickack_ = enable;
+    return *this;
+}
+
+socket_options& socket_options::busy_poll(int usecs)
+{
+    busy_poll_ = usecs;
+    return *this;
+}
+
+socket_options& socket_options::notsent_lowat(int bytes)
+{
+    notsent_lowat_ = bytes;
+    return *this;
+}
+
+socket_options& socket_options::tos(int value)
+{
+    tos_ = value;
+    return *this;
+}
+
+void socket_options::apply(easy& handle) const
+{
+    // libcurl applies CURLOPT_TCP_NODELAY on its own; keep the two in sync
+    if(nodelay_ != unset)
+        handle.set(CURLOPT_TCP_NODELAY, static_cast<long>(nodelay_));
+
+    handle.set(CURLOPT_SOCKOPTDATA, this);
+    handle.set(CURLOPT_SOCKOPTFUNCTION, socket_options::callback_);
+}
+
+int socket_options::callback_(void * arg, curl_socket_t fd, curlsocktype purpose)
+{
+    const socket_options * opts = static_cast<const socket_options *>(arg);
+    if(purpose != CURLSOCKTYPE_IPCXN)
+        return CURL_SOCKOPT_OK;
+
+    // buffer sizes only take full effect when set before connect(), which
+    // is when libcurl calls this
+    if(opts->rcvbuf_ != unset)
+        setopt(fd, SOL_SOCKET, SO_RCVBUF, opts->rcvbuf_);
+    if(opts->sndbuf_ != unset)
+        setopt(fd, SOL_SOCKET, SO_SNDBUF, opts->sndbuf_);
+    if(opts->nodelay_ != unset)
+        setopt(fd, IPPROTO_TCP, TCP_NODELAY, opts->nodelay_);
+#ifdef TCP_QUICKACK
+    if(opts->quickack_ != unset)
+        setopt(fd, IPPROTO_TCP, TCP_QUICKACK, opts->quickack_);
+#endif
+#ifdef SO_BUSY_POLL
+    if(opts->busy_poll_ != unset)
+        setopt(fd, SOL_SOCKET, SO_BUSY_POLL, opts->busy_poll_);
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+    if(opts->notsent_lowat_ != unset)
+        setopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, opts->notsent_lowat_);
+#endif
+    if(opts->tos_ != unset)
+    {
+        // the socket may be either IPv4 or IPv6
+        setopt(fd, IPPROTO_IP, IP_TOS, opts->tos_);
+#ifdef IPV6_TCLASS
+        setopt(fd, IPPROTO_IPV6, IPV6_TCLASS, opts->tos_);
+#endif
+    }
+
+    return CURL_SOCKOPT_OK;
+}
+
+}
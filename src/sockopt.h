@@ -0,0 +1,77 @@
+/*
+ * sockopt.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_SOCKOPT_H
+#define CURLPP_SOCKOPT_H
+
+#include "curl++.h"
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Kernel socket tuning applied through CURLOPT_SOCKOPTFUNCTION.
+//
+// Options left unset are not touched. Options the platform does not know
+// are skipped, and a failing setsockopt (e.g. SO_BUSY_POLL without
+// CAP_NET_ADMIN) does not fail the connection. Note that fixing
+// SO_RCVBUF/SO_SNDBUF disables the kernel's own buffer autotuning on Linux.
+//
+// `apply` stores a pointer to the policy in the handle, so the policy has to
+// outlive every transfer made with it.
+class socket_options
+{
+public:
+    socket_options();
+
+    // Buffers sized for the bandwidth-delay product of the path, Nagle
+    // on, throughput class of service.
+    static socket_options bulk(double bytes_per_sec, double rtt_secs);
+
+    // Nagle off, immediate ACKs, small unsent backlog, busy polling and
+    // low-delay class of service.
+    static socket_options low_latency();
+
+    socket_options& recv_buffer(int bytes);
+    socket_options& send_buffer(int bytes);
+    socket_options& buffers_for(double bytes_per_sec, double rtt_secs);
+    socket_options& nodelay(bool enable);
+    socket_options& quickack(bool enable);
+    socket_options& busy_poll(int usecs);
+    socket_options& notsent_lowat(int bytes);
+    socket_options& tos(int value);
+
+    void apply(easy& handle) const;
+
+private:
+    int rcvbuf_;
+    int sndbuf_;
+    int nodelay_;
+    int quickack_;
+    int busy_poll_;
+    int notsent_lowat_;
+    int tos_;
+
+    static int callback_(void *, curl_socket_t, curlsocktype);
+};
+
+}
+
+#endif /* CURLPP_SOCKOPT_H */
@@ -0,0 +1,400 @@
+/*
+ * subscription.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "subscription.h"
+#include <algorithm>
+#include <random>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+struct subscription_manager::sub_
+{
+    subscription_manager * owner;
+    id ident;
+    easy handle;
+    data_callback on_data;
+    end_callback on_end;
+    std::chrono::milliseconds backoff;
+    bool active;        // currently added to the multi handle
+    bool received;      // got data since it was last started
+    clock::time_point started;      // when it was last started
+};
+
+namespace
+{
+    std::chrono::milliseconds jittered(std::chrono::milliseconds delay)
+    {
+        static thread_local std::minstd_rand rng(std::random_device{}());
+        std::uniform_real_distribution<double> factor(0.5, 1.5);
+        return std::chrono::milliseconds(
+            static_cast<long long>(delay.count() * factor(rng)));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+subscription_manager::subscription_manager()
+    : subscription_manager(options())
+{}
+
+subscription_manager::subscription_manager(options opts)
+    : opts_(std::move(opts))
+    , epoll_(epoll_create1(EPOLL_CLOEXEC))
+    , wakeup_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+    , running_(true)
+    , next_id_(1)
+    , count_(0)
+    , timer_set_(false)
+{
+    if(epoll_ < 0 || wakeup_ < 0)
+    {
+        if(epoll_ >= 0) close(epoll_);
+        if(wakeup_ >= 0) close(wakeup_);
+        throw ERROR("Failed to create epoll instance");
+    }
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = wakeup_;
+    epoll_ctl(epoll_, EPOLL_CTL_ADD, wakeup_, &ev);
+
+    multi_.set(CURLMOPT_SOCKETDATA, this);
+    multi_.set(CURLMOPT_SOCKETFUNCTION, subscription_manager::socket_cb_);
+    multi_.set(CURLMOPT_TIMERDATA, this);
+    multi_.set(CURLMOPT_TIMERFUNCTION, subscription_manager::timer_cb_);
+
+    thread_ = std::thread(&subscription_manager::run_, this);
+}
+
+subscription_manager::~subscription_manager()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    uint64_t one = 1;
+    if(write(wakeup_, &one, sizeof(one)) < 0)
+    {}
+    thread_.join();
+
+    for(auto&& entry : subs_)
+        detach_(*entry.second);
+    subs_.clear();
+
+    close(wakeup_);
+    close(epoll_);
+}
+
+subscription_manager::id subscription_manager::subscribe(
+    const std::string& address, data_callback on_data,
+    end_callback on_end, setup_callback setup)
+{
+    std::unique_ptr<sub_> s(new sub_{this, 0, easy(), std::move(on_data),
+        std::move(on_end), opts_.min_backoff, false, false, clock::time_point()});
+
+    // configure on the calling thread; the handle is not shared yet
+    s->handle.set(CURLOPT_URL, address);
+    s->handle.set(CURLOPT_BUFFERSIZE, opts_.recv_buffer);
+    s->handle.set(CURLOPT_NOSIGNAL, 1L);
+    if(setup)
+        setup(s->handle);
+    s->handle.set(CURLOPT_PRIVATE, s.get());
+    s->handle.set(CURLOPT_WRITEDATA, s.get());
+    s->handle.set(CURLOPT_WRITEFUNCTION, subscription_manager::write_cb_);
+
+    id ident;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ident = s->ident = next_id_++;
+        ++count_;
+    }
+
+    // std::function needs a copyable target
+    std::shared_ptr<std::unique_ptr<sub_>> holder =
+        std::make_shared<std::unique_ptr<sub_>>(std::move(s));
+    post_([this, holder]{
+        sub_& sub = **holder;
+        subs_[sub.ident] = std::move(*holder);
+        start_(sub);
+    });
+    return ident;
+}
+
+void subscription_manager::unsubscribe(id sub)
+{
+    post_([this, sub]{
+        auto it = subs_.find(sub);
+        if(it == subs_.end())
+            return;
+        detach_(*it->second);
+        subs_.erase(it);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        --count_;
+    });
+}
+
+size_t subscription_manager::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return count_;
+}
+
+void subscription_manager::post_(std::function<void()> cmd)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        commands_.push_back(std::move(cmd));
+    }
+    uint64_t one = 1;
+    if(write(wakeup_, &one, sizeof(one)) < 0)
+    {}  // counter already non-zero; the loop wakes up anyway
+}
+
+void subscription_manager::run_()
+{
+    std::vector<epoll_event> events(std::max<size_t>(opts_.max_events, 1));
+    std::vector<std::function<void()>> commands;
+
+    for(;;)
+    {
+        int n = epoll_wait(epoll_, events.data(), events.size(), wait_time_());
+
+        for(int i = 0; i < n; ++i)
+        {
+            if(events[i].data.fd == wakeup_)
+            {
+                uint64_t value;
+                if(read(wakeup_, &value, sizeof(value)) < 0)
+                {}
+                continue;
+            }
+
+            int mask = 0;
+            if(events[i].events & EPOLLIN)
+                mask |= CURL_CSELECT_IN;
+            if(events[i].events & EPOLLOUT)
+                mask |= CURL_CSELECT_OUT;
+            if(events[i].events & (EPOLLERR | EPOLLHUP))
+                mask |= CURL_CSELECT_ERR;
+            socket_action_(events[i].data.fd, mask);
+        }
+
+        // libcurl's timeout, if it expired while waiting
+        if(timer_set_ && deadline_ <= clock::now())
+        {
+            timer_set_ = false;
+            socket_action_(CURL_SOCKET_TIMEOUT, 0);
+        }
+
+        CURL * handle;
+        CURLcode result;
+        while(multi_.next_done(handle, result))
+            finished_(handle, result);
+
+        // restart subscriptions whose backoff has passed
+        clock::time_point now = clock::now();
+        while(!retries_.empty() && retries_.top().first <= now)
+        {
+            auto it = subs_.find(retries_.top().second);
+            retries_.pop();
+            if(it != subs_.end() && !it->second->active)
+                start_(*it->second);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(!running_)
+                break;
+            commands.swap(commands_);
+        }
+        for(auto&& cmd : commands)
+            cmd();
+        commands.clear();
+    }
+}
+
+void subscription_manager::socket_action_(curl_socket_t socket, int mask)
+{
+    // nothing may escape the manager's thread; transfers hit by a failing
+    // call end with an error of their own
+    try
+    {
+        multi_.socket_action(socket, mask);
+    }
+    catch(const error&)
+    {}
+}
+
+void subscription_manager::start_(sub_& s)
+{
+    s.received = false;
+    s.started = clock::now();
+    try
+    {
+        multi_.add(s.handle);
+        s.active = true;
+    }
+    catch(const error&)
+    {
+        // nothing may escape the manager's thread; try again later
+        s.backoff = std::min(s.backoff * 2, opts_.max_backoff);
+        schedule_(s);
+    }
+}
+
+void subscription_manager::detach_(sub_& s)
+{
+    if(!s.active)
+        return;
+    s.active = false;
+    try
+    {
+        multi_.remove(s.handle);
+    }
+    catch(const error&)
+    {}
+}
+
+void subscription_manager::finished_(CURL * handle, CURLcode result)
+{
+    sub_ * s = nullptr;
+    curl_easy_getinfo(handle, CURLINFO_PRIVATE, &s);
+    if(s == nullptr)
+        return;
+
+    detach_(*s);
+
+    long status = 0;
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+    if(s->on_end)
+    {
+        try
+        {
+            s->on_end(result, status);
+        }
+        catch(...)
+        {
+            result = CURLE_ABORTED_BY_CALLBACK;
+        }
+    }
+
+    // a completed long poll is renewed at once, unless it came back so
+    // quickly that renewing it would spin against the server; a 3xx that
+    // was not followed would only be answered the same way again
+    if(result == CURLE_OK && status >= 200 && status < 300)
+    {
+        s->backoff = opts_.min_backoff;
+        if(clock::now() - s->started >= opts_.min_backoff)
+            start_(*s);
+        else
+            schedule_(*s);
+        return;
+    }
+
+    if(s->received)
+        s->backoff = opts_.min_backoff;
+    else
+        s->backoff = std::min(s->backoff * 2, opts_.max_backoff);
+    schedule_(*s);
+}
+
+void subscription_manager::schedule_(sub_& s)
+{
+    // jitter keeps thousands of streams dropped at once by a restarting
+    // server from reconnecting in lockstep
+    retries_.emplace(clock::now() + jittered(s.backoff), s.ident);
+}
+
+int subscription_manager::wait_time_()
+{
+    // -1 waits until a socket or the wakeup descriptor becomes ready
+    clock::time_point until = clock::time_point::max();
+    if(timer_set_)
+        until = deadline_;
+    if(!retries_.empty())
+        until = std::min(until, retries_.top().first);
+    if(until == clock::time_point::max())
+        return -1;
+
+    // round up, epoll_wait would otherwise return just before the deadline
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        until - clock::now() + std::chrono::microseconds(999)).count();
+    return static_cast<int>(std::max<long long>(wait, 0));
+}
+
+int subscription_manager::socket_cb_(CURL *, curl_socket_t socket, int what,
+                                     void * arg, void *)
+{
+    subscription_manager * self = static_cast<subscription_manager *>(arg);
+
+    if(what == CURL_POLL_REMOVE)
+    {
+        epoll_ctl(self->epoll_, EPOLL_CTL_DEL, socket, nullptr);
+        return 0;
+    }
+
+    epoll_event ev = {};
+    ev.data.fd = socket;
+    if(what & CURL_POLL_IN)
+        ev.events |= EPOLLIN;
+    if(what & CURL_POLL_OUT)
+        ev.events |= EPOLLOUT;
+
+    if(epoll_ctl(self->epoll_, EPOLL_CTL_MOD, socket, &ev) != 0)
+        epoll_ctl(self->epoll_, EPOLL_CTL_ADD, socket, &ev);
+    return 0;
+}
+
+int subscription_manager::timer_cb_(CURLM *, long timeout_ms, void * arg)
+{
+    subscription_manager * self = static_cast<subscription_manager *>(arg);
+    self->timer_set_ = timeout_ms >= 0;
+    if(self->timer_set_)
+        self->deadline_ = clock::now() + std::chrono::milliseconds(timeout_ms);
+    return 0;
+}
+
+size_t subscription_manager::write_cb_(char * ptr, size_t size, size_t nmemb,
+                                       void * arg)
+{
+    sub_ * s = static_cast<sub_ *>(arg);
+    s->received = true;
+    try
+    {
+        s->on_data(ptr, size*nmemb);
+    }
+    catch(...)
+    {
+        // ends this request; it is restarted like any other failure
+        return 0;
+    }
+    return size*nmemb;
+}
+
+}
+
+#undef ERROR
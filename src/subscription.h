@@ -0,0 +1,133 @@
+/*
+ * subscription.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_SUBSCRIPTION_H
+#define CURLPP_SUBSCRIPTION_H
+
+#include "curl++.h"
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Manager for large numbers of long-poll or streaming requests.
+//
+// All subscriptions share one multi handle driven through
+// curl_multi_socket_action from an epoll loop on a single thread (Linux
+// only), so idle streams cost a socket and an easy handle, nothing more.
+// Response data is handed to the subscriber straight from libcurl's receive
+// buffer, whose size can be kept small through `options::recv_buffer`.
+//
+// When a request completes with a 2xx response it is started again right
+// away, so the next event is not delayed; one that completed in less than
+// `min_backoff` is restarted after a randomized delay around `min_backoff`,
+// so servers answering at once are not polled in a loop. A failed request,
+// including one answered with a redirect that was not followed, is retried
+// after a randomized delay: `min_backoff` if it delivered data before it
+// failed, doubling up to `max_backoff` while requests keep failing without
+// any. Exceptions thrown by callbacks end the request like a failure.
+class subscription_manager
+{
+public:
+    typedef unsigned long id;
+
+    // called on the manager's thread for each piece of response data
+    typedef std::function<void(const char * data, size_t size)> data_callback;
+
+    // called on the manager's thread when a request ends, before it is
+    // started or scheduled again
+    typedef std::function<void(CURLcode result, long status)> end_callback;
+
+    // extra per-subscription configuration, e.g. headers or timeouts
+    typedef std::function<void(easy& handle)> setup_callback;
+
+    struct options
+    {
+        std::chrono::milliseconds min_backoff = std::chrono::milliseconds(1000);
+        std::chrono::milliseconds max_backoff = std::chrono::milliseconds(60000);
+        long recv_buffer = 4096;
+        size_t max_events = 1024;   // epoll events handled per wakeup
+    };
+
+    subscription_manager();
+    explicit subscription_manager(options opts);
+    ~subscription_manager();
+
+    subscription_manager(const subscription_manager& other) = delete;
+    subscription_manager& operator = (const subscription_manager& other) = delete;
+
+    // Both may be called from any thread; the request is started and
+    // stopped asynchronously on the manager's thread.
+    id subscribe(const std::string& address, data_callback on_data,
+                 end_callback on_end = nullptr, setup_callback setup = nullptr);
+    void unsubscribe(id sub);
+
+    size_t size() const;
+
+private:
+    typedef std::chrono::steady_clock clock;
+    struct sub_;
+
+    options opts_;
+    multi multi_;
+    int epoll_;
+    int wakeup_;
+    std::thread thread_;
+
+    mutable std::mutex mutex_;
+    std::vector<std::function<void()>> commands_;
+    bool running_;
+    id next_id_;
+    size_t count_;
+
+    // only touched by the manager's thread
+    std::unordered_map<id, std::unique_ptr<sub_>> subs_;
+    std::priority_queue<std::pair<clock::time_point, id>,
+                        std::vector<std::pair<clock::time_point, id>>,
+                        std::greater<std::pair<clock::time_point, id>>> retries_;
+    clock::time_point deadline_;    // of libcurl's timer
+    bool timer_set_;
+
+    void post_(std::function<void()> cmd);
+    void run_();
+    void socket_action_(curl_socket_t socket, int mask);
+    void start_(sub_& s);
+    void detach_(sub_& s);
+    void finished_(CURL * handle, CURLcode result);
+    void schedule_(sub_& s);
+    int wait_time_();
+
+    static int socket_cb_(CURL *, curl_socket_t, int, void *, void *);
+    static int timer_cb_(CURLM *, long, void *);
+    static size_t write_cb_(char *, size_t, size_t, void *);
+};
+
+}
+
+#endif /* CURLPP_SUBSCRIPTION_H */
@@ -0,0 +1,634 @@
+/*
+ * tracing.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tracing.h"
+#include <algorithm>
+#include <cstring>
+#include <openssl/rand.h>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+namespace
+{
+    struct span_attribute
+    {
+        std::string key;
+        std::string text;
+        int64_t number;
+        bool is_number;
+    };
+
+    struct span_event
+    {
+        int64_t time;
+        std::string name;
+        std::vector<span_attribute> attributes;
+    };
+}
+
+struct tracer::record_
+{
+    trace_context context;
+    std::string parent;         // hex span id, empty for root spans
+    std::string name;
+    int64_t start;              // ns since the epoch
+    int64_t end;
+    std::vector<span_attribute> attributes;
+    std::vector<span_event> events;
+    int status;                 // OTLP status code: 0 unset, 1 ok, 2 error
+    std::string message;
+};
+
+namespace
+{
+    int64_t now_ns()
+    {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+    }
+
+    void random_bytes(unsigned char * buf, size_t size)
+    {
+        // all-zero ids are invalid
+        do
+        {
+            if(RAND_bytes(buf, size) != 1)
+                throw ERROR("Failed to generate trace id");
+        }
+        while(std::all_of(buf, buf + size, [](unsigned char c){ return c == 0; }));
+    }
+
+    std::string to_hex(const unsigned char * data, size_t size)
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string result;
+        for(size_t i = 0; i < size; ++i)
+        {
+            result.push_back(digits[data[i] >> 4]);
+            result.push_back(digits[data[i] & 15]);
+        }
+        return result;
+    }
+
+    bool from_hex(const std::string& text, size_t pos, unsigned char * out, size_t size)
+    {
+        for(size_t i = 0; i < size * 2; ++i)
+        {
+            char c = text[pos + i];
+            int v = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+            if(v < 0)
+                return false;
+            if(i % 2 == 0)
+                out[i / 2] = v << 4;
+            else
+                out[i / 2] |= v;
+        }
+        return true;
+    }
+
+    void json_string(std::string& out, const std::string& s)
+    {
+        out.push_back('"');
+        for(unsigned char c : s)
+        {
+            if(c == '"' || c == '\\')
+            {
+                out.push_back('\\');
+                out.push_back(c);
+            }
+            else if(c < 0x20)
+            {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            }
+            else
+                out.push_back(c);
+        }
+        out.push_back('"');
+    }
+
+    void json_attributes(std::string& out, const std::vector<span_attribute>& attrs)
+    {
+        out += "[";
+        for(size_t i = 0; i < attrs.size(); ++i)
+        {
+            if(i)
+                out += ",";
+            out += "{\"key\":";
+            json_string(out, attrs[i].key);
+            // OTLP-JSON encodes 64 bit integers as strings
+            if(attrs[i].is_number)
+                out += ",\"value\":{\"intValue\":\"" + std::to_string(attrs[i].number) + "\"}}";
+            else
+            {
+                out += ",\"value\":{\"stringValue\":";
+                json_string(out, attrs[i].text);
+                out += "}}";
+            }
+        }
+        out += "]";
+    }
+
+    span_attribute text_attribute(const std::string& key, const std::string& value)
+    {
+        return span_attribute{key, value, 0, false};
+    }
+
+    span_attribute number_attribute(const std::string& key, int64_t value)
+    {
+        return span_attribute{key, std::string(), value, true};
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+trace_context::trace_context()
+    : flags_(0)
+{
+    memset(trace_, 0, sizeof(trace_));
+    memset(span_, 0, sizeof(span_));
+}
+
+trace_context trace_context::root(bool sampled)
+{
+    trace_context ctx;
+    random_bytes(ctx.trace_, sizeof(ctx.trace_));
+    random_bytes(ctx.span_, sizeof(ctx.span_));
+    ctx.flags_ = sampled ? 1 : 0;
+    return ctx;
+}
+
+trace_context trace_context::parse(const std::string& traceparent)
+{
+    // "00-" 32 hex "-" 16 hex "-" 2 hex; later versions may append fields
+    trace_context ctx;
+    const std::string& s = traceparent;
+    if(s.size() < 55 || s[2] != '-' || s[35] != '-' || s[52] != '-'
+       || (s.size() > 55 && (s.compare(0, 2, "00") == 0 || s[55] != '-')))
+        return trace_context();
+
+    unsigned char version;
+    if(!from_hex(s, 0, &version, 1) || version == 0xff
+       || !from_hex(s, 3, ctx.trace_, sizeof(ctx.trace_))
+       || !from_hex(s, 36, ctx.span_, sizeof(ctx.span_))
+       || !from_hex(s, 53, &ctx.flags_, 1)
+       || !ctx.valid())
+        return trace_context();
+    return ctx;
+}
+
+trace_context trace_context::child() const
+{
+    trace_context ctx(*this);
+    random_bytes(ctx.span_, sizeof(ctx.span_));
+    return ctx;
+}
+
+bool trace_context::valid() const
+{
+    auto zero = [](unsigned char c){ return c == 0; };
+    return !std::all_of(trace_, trace_ + sizeof(trace_), zero)
+        && !std::all_of(span_, span_ + sizeof(span_), zero);
+}
+
+std::string trace_context::trace_id() const
+{
+    return to_hex(trace_, sizeof(trace_));
+}
+
+std::string trace_context::span_id() const
+{
+    return to_hex(span_, sizeof(span_));
+}
+
+std::string trace_context::traceparent() const
+{
+    return "00-" + trace_id() + "-" + span_id() + "-" + to_hex(&flags_, 1);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+tracer::tracer(const std::string& path)
+    : tracer(path, options())
+{}
+
+tracer::tracer(const std::string& path, options opts)
+    : opts_(std::move(opts))
+    , file_(fopen(path.c_str(), "ae"))
+    , mask_(0)
+    , head_(0)
+    , tail_(0)
+    , exported_(0)
+    , dropped_(0)
+    , running_(true)
+{
+    if(file_ == nullptr)
+        throw ERROR("Failed to open trace file");
+
+    size_t capacity = 2;
+    while(capacity < opts_.capacity)
+        capacity <<= 1;
+    cells_.reset(new cell_[capacity]);
+    for(size_t i = 0; i < capacity; ++i)
+    {
+        cells_[i].seq.store(i, std::memory_order_relaxed);
+        cells_[i].value = nullptr;
+    }
+    mask_ = capacity - 1;
+    opts_.batch_size = std::max<size_t>(1, std::min(opts_.batch_size, capacity));
+
+    thread_ = std::thread(&tracer::run_, this);
+}
+
+tracer::~tracer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    wakeup_.notify_one();
+    thread_.join();
+    fclose(file_);
+}
+
+void tracer::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    export_();
+}
+
+void tracer::submit_(std::unique_ptr<record_> r)
+{
+    // bounded multi-producer queue after Dmitry Vyukov: a cell is free for
+    // the producer holding ticket `pos` when its sequence equals `pos`
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    for(;;)
+    {
+        cell_& c = cells_[pos & mask_];
+        size_t seq = c.seq.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+        if(diff == 0)
+        {
+            if(tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                c.value = r.release();
+                c.seq.store(pos + 1, std::memory_order_release);
+                break;
+            }
+        }
+        else if(diff < 0)
+        {
+            ++dropped_;
+            return;
+        }
+        else
+            pos = tail_.load(std::memory_order_relaxed);
+    }
+
+    // a missed wakeup only delays the export until the next interval
+    if(pos + 1 - head_.load(std::memory_order_relaxed) >= opts_.batch_size)
+        wakeup_.notify_one();
+}
+
+bool tracer::pop_(record_ *& r)
+{
+    // single consumer, serialized by `mutex_`
+    size_t pos = head_.load(std::memory_order_relaxed);
+    cell_& c = cells_[pos & mask_];
+    size_t seq = c.seq.load(std::memory_order_acquire);
+    if(static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1) < 0)
+        return false;
+
+    r = c.value;
+    c.value = nullptr;
+    c.seq.store(pos + mask_ + 1, std::memory_order_release);
+    head_.store(pos + 1, std::memory_order_relaxed);
+    return true;
+}
+
+void tracer::run_()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(running_)
+    {
+        wakeup_.wait_for(lock, opts_.interval);
+        try
+        {
+            export_();
+        }
+        catch(const error&)
+        {
+            // keep collecting; the next export may succeed
+        }
+    }
+    try
+    {
+        export_();
+    }
+    catch(const error&)
+    {}
+}
+
+void tracer::export_()
+{
+    std::vector<std::unique_ptr<record_>> batch;
+    record_ * r;
+    while(pop_(r))
+    {
+        batch.emplace_back(r);
+        if(batch.size() == opts_.batch_size)
+        {
+            write_(batch);
+            batch.clear();
+        }
+    }
+    if(!batch.empty())
+        write_(batch);
+}
+
+void tracer::write_(const std::vector<std::unique_ptr<record_>>& batch)
+{
+    std::string out = "{\"resourceSpans\":[{\"resource\":{\"attributes\":";
+    json_attributes(out, {text_attribute("service.name", opts_.service)});
+    out += "},\"scopeSpans\":[{\"scope\":{\"name\":\"curl++\"},\"spans\":[";
+
+    for(size_t i = 0; i < batch.size(); ++i)
+    {
+        const record_& s = *batch[i];
+        if(i)
+            out += ",";
+        out += "{\"traceId\":\"" + s.context.trace_id() + "\"";
+        out += ",\"spanId\":\"" + s.context.span_id() + "\"";
+        if(!s.parent.empty())
+            out += ",\"parentSpanId\":\"" + s.parent + "\"";
+        out += ",\"name\":";
+        json_string(out, s.name);
+        out += ",\"kind\":3";   // SPAN_KIND_CLIENT
+        out += ",\"startTimeUnixNano\":\"" + std::to_string(s.start) + "\"";
+        out += ",\"endTimeUnixNano\":\"" + std::to_string(s.end) + "\"";
+        out += ",\"attributes\":";
+        json_attributes(out, s.attributes);
+
+        out += ",\"events\":[";
+        for(size_t j = 0; j < s.events.size(); ++j)
+        {
+            const span_event& e = s.events[j];
+            if(j)
+                out += ",";
+            out += "{\"timeUnixNano\":\"" + std::to_string(e.time) + "\",\"name\":";
+            json_string(out, e.name);
+            out += ",\"attributes\":";
+            json_attributes(out, e.attributes);
+            out += "}";
+        }
+        out += "],\"status\":{";
+        if(s.status)
+            out += "\"code\":" + std::to_string(s.status);
+        if(!s.message.empty())
+        {
+            out += s.status ? ",\"message\":" : "\"message\":";
+            json_string(out, s.message);
+        }
+        out += "}}";
+    }
+    out += "]}]}]}\n";
+
+    if(fwrite(out.data(), 1, out.size(), file_) != out.size() || fflush(file_) != 0)
+        throw ERROR("Failed to write trace file");
+    exported_ += batch.size();
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+span::span(tracer& t, const std::string& name)
+    : tracer_(t)
+{
+    init_(trace_context(), false, name);
+}
+
+span::span(tracer& t, const trace_context& parent, const std::string& name)
+    : tracer_(t)
+{
+    init_(parent, parent.valid(), name);
+}
+
+span::~span()
+{
+    try
+    {
+        submit_();
+    }
+    catch(...)
+    {}
+}
+
+void span::init_(const trace_context& parent, bool has_parent, const std::string& name)
+{
+    context_ = has_parent ? parent.child() : trace_context::root();
+    requests_ = 0;
+    attempt_ = 0;
+    retries_ = 0;
+
+    if(!context_.sampled())
+        return;
+    record_.reset(new tracer::record_);
+    record_->context = context_;
+    if(has_parent)
+        record_->parent = parent.span_id();
+    record_->name = name;
+    record_->start = now_ns();
+    record_->end = 0;
+    record_->status = 0;
+}
+
+void span::attach(easy& handle, list& headers)
+{
+    std::string header = "traceparent: " + context_.traceparent();
+    headers += header.c_str();
+    handle.set(CURLOPT_HTTPHEADER, *headers);
+
+#if LIBCURL_VERSION_NUM >= 0x075000
+    handle.set(CURLOPT_PREREQDATA, static_cast<void *>(this));
+    handle.set(CURLOPT_PREREQFUNCTION, span::prereq_);
+#endif
+}
+
+void span::attribute(const std::string& key, const std::string& value)
+{
+    if(record_)
+        record_->attributes.push_back(text_attribute(key, value));
+}
+
+void span::attribute(const std::string& key, int64_t value)
+{
+    if(record_)
+        record_->attributes.push_back(number_attribute(key, value));
+}
+
+void span::event(const std::string& name)
+{
+    if(record_)
+        record_->events.push_back(span_event{now_ns(), name, {}});
+}
+
+void span::retry(const std::string& reason)
+{
+    ++retries_;
+    requests_ = 0;
+    if(!record_)
+        return;
+    record_->events.push_back(span_event{now_ns(), "retry", {
+        text_attribute("reason", reason),
+        number_attribute("http.request.resend_count", retries_),
+    }});
+    attempt_ = record_->events.size();
+}
+
+void span::end(easy& handle, CURLcode result)
+{
+    if(!record_)
+        return;
+    tracer::record_& r = *record_;
+
+    auto value = [&handle](CURLINFO info) {
+        return static_cast<int64_t>(handle.info<curl_off_t>(info));
+    };
+
+    const char * url = handle.info<const char *>(CURLINFO_EFFECTIVE_URL);
+    const char * ip = handle.info<const char *>(CURLINFO_PRIMARY_IP);
+    long status = handle.info<long>(CURLINFO_RESPONSE_CODE);
+    long redirects = handle.info<long>(CURLINFO_REDIRECT_COUNT);
+    std::string method = "GET";
+#if LIBCURL_VERSION_NUM >= 0x074800
+    if(const char * m = handle.info<const char *>(CURLINFO_EFFECTIVE_METHOD))
+        method = m;
+#endif
+    if(r.name.empty())
+        r.name = method;
+
+    r.attributes.push_back(text_attribute("http.request.method", method));
+    if(url)
+        r.attributes.push_back(text_attribute("url.full", url));
+    if(ip && *ip)
+    {
+        r.attributes.push_back(text_attribute("network.peer.address", ip));
+        r.attributes.push_back(number_attribute("network.peer.port",
+                                                handle.info<long>(CURLINFO_PRIMARY_PORT)));
+    }
+    if(status)
+        r.attributes.push_back(number_attribute("http.response.status_code", status));
+
+    switch(handle.info<long>(CURLINFO_HTTP_VERSION))
+    {
+    case CURL_HTTP_VERSION_1_0:
+        r.attributes.push_back(text_attribute("network.protocol.version", "1.0"));
+        break;
+    case CURL_HTTP_VERSION_1_1:
+        r.attributes.push_back(text_attribute("network.protocol.version", "1.1"));
+        break;
+    case CURL_HTTP_VERSION_2_0:
+        r.attributes.push_back(text_attribute("network.protocol.version", "2"));
+        break;
+    case CURL_HTTP_VERSION_3:
+        r.attributes.push_back(text_attribute("network.protocol.version", "3"));
+        break;
+    }
+
+    r.attributes.push_back(number_attribute("http.response.body.size", value(CURLINFO_SIZE_DOWNLOAD_T)));
+    r.attributes.push_back(number_attribute("http.request.body.size", value(CURLINFO_SIZE_UPLOAD_T)));
+    if(retries_)
+        r.attributes.push_back(number_attribute("http.request.resend_count", retries_));
+    if(redirects)
+        r.attributes.push_back(number_attribute("curl.redirect_count", redirects));
+
+    // phase timings of the last attempt, in microseconds from its start
+    r.attributes.push_back(number_attribute("curl.time.namelookup_us", value(CURLINFO_NAMELOOKUP_TIME_T)));
+    r.attributes.push_back(number_attribute("curl.time.connect_us", value(CURLINFO_CONNECT_TIME_T)));
+    r.attributes.push_back(number_attribute("curl.time.appconnect_us", value(CURLINFO_APPCONNECT_TIME_T)));
+    r.attributes.push_back(number_attribute("curl.time.pretransfer_us", value(CURLINFO_PRETRANSFER_TIME_T)));
+    r.attributes.push_back(number_attribute("curl.time.starttransfer_us", value(CURLINFO_STARTTRANSFER_TIME_T)));
+    r.attributes.push_back(number_attribute("curl.time.total_us", value(CURLINFO_TOTAL_TIME_T)));
+    if(redirects)
+        r.attributes.push_back(number_attribute("curl.time.redirect_us", value(CURLINFO_REDIRECT_TIME_T)));
+
+    // requests after the first one of an attempt followed redirects, unless
+    // there were none; then they were resent, e.g. for authentication
+    if(redirects == 0)
+        for(size_t i = attempt_; i < r.events.size(); ++i)
+            if(r.events[i].name == "redirect")
+                r.events[i].name = "resend";
+
+    // client spans count 4xx and 5xx responses as errors
+    if(result != CURLE_OK)
+    {
+        r.status = 2;
+        r.message = curl_easy_strerror(result);
+        r.attributes.push_back(text_attribute("error.type", r.message));
+    }
+    else if(status >= 400)
+    {
+        r.status = 2;
+        r.attributes.push_back(text_attribute("error.type", std::to_string(status)));
+    }
+
+    submit_();
+}
+
+void span::end()
+{
+    submit_();
+}
+
+void span::submit_()
+{
+    if(!record_)
+        return;
+    record_->end = now_ns();
+    if(record_->name.empty())
+        record_->name = "HTTP";
+    tracer_.submit_(std::move(record_));
+}
+
+int span::prereq_(void * arg, char * primary_ip, char *, int primary_port, int)
+{
+    span * self = static_cast<span *>(arg);
+    if(self->record_)
+    {
+        self->record_->events.push_back(span_event{
+            now_ns(), self->requests_ ? "redirect" : "request", {
+                text_attribute("network.peer.address", primary_ip ? primary_ip : ""),
+                number_attribute("network.peer.port", primary_port),
+            }});
+    }
+    ++self->requests_;
+    return 0;   // CURL_PREREQFUNC_OK
+}
+
+}
+
+#undef ERROR
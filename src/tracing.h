@@ -0,0 +1,206 @@
+/*
+ * tracing.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_TRACING_H
+#define CURLPP_TRACING_H
+
+#include "curl++.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// W3C trace context (https://www.w3.org/TR/trace-context/)
+class trace_context
+{
+public:
+    // invalid context, all ids zero
+    trace_context();
+
+    // start a new trace
+    static trace_context root(bool sampled = true);
+
+    // context from a traceparent header value; invalid if it does not parse
+    static trace_context parse(const std::string& traceparent);
+
+    // same trace and flags, new span id
+    trace_context child() const;
+
+    bool valid() const;
+
+    inline bool sampled() const
+    { return flags_ & 1; }
+
+    // lower-case hex
+    std::string trace_id() const;
+    std::string span_id() const;
+
+    // "00-<trace id>-<span id>-<flags>"
+    std::string traceparent() const;
+
+private:
+    unsigned char trace_[16];
+    unsigned char span_[8];
+    unsigned char flags_;
+};
+
+
+
+class span;
+
+////////////////////////////////////////////////////////////////////////////////
+// Collects finished spans and writes them to an OTLP-JSON file.
+//
+// Spans are handed over through a bounded lock-free ring buffer, so ending a
+// span never blocks on the exporter; when the buffer is full the span is
+// dropped and counted. An exporter thread writes the buffered spans every
+// `interval`, or earlier once `batch_size` are waiting, as one
+// ExportTraceServiceRequest JSON object per line (the OTLP file exporter
+// format).
+class tracer
+{
+public:
+    struct options
+    {
+        std::string service = "curl++";
+        size_t capacity = 4096;         // rounded up to a power of two
+        size_t batch_size = 512;
+        std::chrono::milliseconds interval = std::chrono::milliseconds(1000);
+    };
+
+    explicit tracer(const std::string& path);
+    tracer(const std::string& path, options opts);
+
+    // exports what is left
+    ~tracer();
+
+    tracer(const tracer& other) = delete;
+    tracer& operator = (const tracer& other) = delete;
+
+    // write all buffered spans now
+    void flush();
+
+    inline uint64_t exported() const
+    { return exported_; }
+
+    inline uint64_t dropped() const
+    { return dropped_; }
+
+private:
+    friend class span;
+    struct record_;
+
+    struct cell_
+    {
+        std::atomic<size_t> seq;
+        record_ * value;
+    };
+
+    options opts_;
+    FILE * file_;
+
+    std::unique_ptr<cell_[]> cells_;
+    size_t mask_;
+    std::atomic<size_t> head_;
+    std::atomic<size_t> tail_;
+    std::atomic<uint64_t> exported_;
+    std::atomic<uint64_t> dropped_;
+
+    std::mutex mutex_;          // consumer side and the exporter's sleep
+    std::condition_variable wakeup_;
+    bool running_;
+    std::thread thread_;
+
+    void submit_(std::unique_ptr<record_> r);
+    bool pop_(record_ *& r);
+    void run_();
+    void export_();
+    void write_(const std::vector<std::unique_ptr<record_>>& batch);
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// One traced transfer, reported to the tracer as a client span.
+//
+// `attach` appends a traceparent header to `headers` and installs it, so add
+// other headers to the list first; the list has to outlive the transfer.
+// Each request libcurl sends is recorded as an event, "request" for the
+// first one and "redirect" for the ones following a redirect. `end` takes
+// the phase timings, status and sizes from the handle. A transfer repeated
+// by the application is marked with `retry` before the next attempt.
+// Unsampled spans still propagate their context but are not exported.
+class span
+{
+public:
+    // a span without parent starts a new trace; `name` defaults to the
+    // request method
+    span(tracer& t, const std::string& name = std::string());
+    span(tracer& t, const trace_context& parent, const std::string& name = std::string());
+
+    // ends the span if `end` was not called
+    ~span();
+
+    span(const span& other) = delete;
+    span& operator = (const span& other) = delete;
+
+    inline const trace_context& context() const
+    { return context_; }
+
+    void attach(easy& handle, list& headers);
+
+    void attribute(const std::string& key, const std::string& value);
+    void attribute(const std::string& key, int64_t value);
+    void event(const std::string& name);
+
+    // the transfer is about to be repeated
+    void retry(const std::string& reason);
+
+    // record the outcome of the (last attempt of the) transfer and submit
+    void end(easy& handle, CURLcode result);
+    void end();
+
+private:
+    tracer& tracer_;
+    trace_context context_;
+    std::unique_ptr<tracer::record_> record_;
+    unsigned int requests_;     // requests sent in the current attempt
+    size_t attempt_;            // index of the attempt's first event
+    unsigned int retries_;
+
+    void init_(const trace_context& parent, bool has_parent, const std::string& name);
+    void submit_();
+
+    static int prereq_(void *, char *, char *, int, int);
+};
+
+}
+
+#endif /* CURLPP_TRACING_H */
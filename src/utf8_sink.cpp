@@ -0,0 +1,453 @@
+/*
+ * utf8_sink.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "utf8_sink.h"
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+namespace
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    const bool host_big_endian = true;
+#else
+    const bool host_big_endian = false;
+#endif
+
+    const uint64_t high_bits = 0x8080808080808080ULL;
+
+    // Windows-1252 0x80..0x9F; the five unassigned bytes map to the C1
+    // controls, as in the WHATWG encoding standard
+    const unsigned short cp1252[32] = {
+        0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+        0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+        0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+        0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178,
+    };
+
+    // index of the first byte at or after `i` that is not ASCII, checking
+    // eight bytes at a time
+    inline size_t skip_ascii(const unsigned char * p, size_t i, size_t n)
+    {
+        for(; i + 8 <= n; i += 8)
+        {
+            uint64_t w;
+            memcpy(&w, p + i, sizeof(w));
+            if(w & high_bits)
+                break;
+        }
+        while(i < n && p[i] < 0x80)
+            ++i;
+        return i;
+    }
+
+    // Length of the valid UTF-8 sequence at `p`; 0 if it is cut off by the
+    // end of the buffer, and minus the length of its maximal invalid
+    // subpart if it is invalid (Unicode 3-7, "U+FFFD substitution").
+    int sequence(const unsigned char * p, size_t n)
+    {
+        unsigned int c = p[0];
+        unsigned int lo = 0x80, hi = 0xBF;
+        int len;
+
+        if(c < 0x80)
+            return 1;
+        else if(c >= 0xC2 && c <= 0xDF)
+            len = 2;
+        else if(c >= 0xE0 && c <= 0xEF)
+        {
+            len = 3;
+            if(c == 0xE0)
+                lo = 0xA0;      // overlong
+            else if(c == 0xED)
+                hi = 0x9F;      // surrogates
+        }
+        else if(c >= 0xF0 && c <= 0xF4)
+        {
+            len = 4;
+            if(c == 0xF0)
+                lo = 0x90;      // overlong
+            else if(c == 0xF4)
+                hi = 0x8F;      // beyond U+10FFFF
+        }
+        else
+            return -1;
+
+        for(int k = 1; k < len; ++k)
+        {
+            if(static_cast<size_t>(k) >= n)
+                return 0;
+            if(p[k] < lo || p[k] > hi)
+                return -k;
+            lo = 0x80;
+            hi = 0xBF;
+        }
+        return len;
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+utf8_sink::utf8_sink(sink& next, charset cs, charset fallback)
+    : next_(next)
+    , declared_(cs)
+    , fallback_(fallback == unknown ? utf8 : fallback)
+    , charset_(unknown)
+    , handle_(nullptr)
+    , started_(false)
+    , high_(0)
+    , errors_(0)
+{}
+
+void utf8_sink::attach(easy& handle)
+{
+    handle_ = &handle;
+}
+
+void utf8_sink::write(const char * data, size_t size)
+{
+    if(!started_)
+    {
+        // a BOM is up to three bytes long
+        head_.append(data, size);
+        if(head_.size() >= 3)
+            start_();
+    }
+    else
+        decode_(reinterpret_cast<const unsigned char *>(data), size);
+    flush_();
+}
+
+void utf8_sink::finish()
+{
+    if(!started_)
+        start_();
+
+    // truncated sequence or lone surrogate at the end of the body
+    if(high_)
+        replace_();
+    if(!carry_.empty())
+        replace_();
+    high_ = 0;
+    carry_.clear();
+
+    flush_();
+    next_.finish();
+}
+
+utf8_sink::charset utf8_sink::charset_of(const std::string& content_type)
+{
+    std::string lower;
+    for(char c : content_type)
+        lower.push_back(static_cast<char>(tolower(static_cast<unsigned char>(c))));
+
+    size_t pos = lower.find("charset=");
+    if(pos == std::string::npos)
+        return unknown;
+    pos += 8;
+
+    size_t end;
+    if(pos < lower.size() && (lower[pos] == '"' || lower[pos] == '\''))
+    {
+        char quote = lower[pos++];
+        end = lower.find(quote, pos);
+    }
+    else
+        end = lower.find_first_of("; \t", pos);
+    std::string name = lower.substr(pos, end == std::string::npos ? end : end - pos);
+
+    if(name == "utf-8" || name == "utf8" || name == "unicode-1-1-utf-8")
+        return utf8;
+    if(name == "iso-8859-1" || name == "iso8859-1" || name == "iso_8859-1"
+       || name == "latin1" || name == "l1" || name == "us-ascii" || name == "ascii"
+       || name == "windows-1252" || name == "cp1252" || name == "x-cp1252")
+        return windows_1252;
+    if(name == "utf-16le" || name == "utf-16")
+        return utf16le;
+    if(name == "utf-16be")
+        return utf16be;
+    return name.empty() ? unknown : other;
+}
+
+void utf8_sink::start_()
+{
+    started_ = true;
+    std::string head;
+    head.swap(head_);
+    const unsigned char * p = reinterpret_cast<const unsigned char *>(head.data());
+    size_t n = head.size();
+
+    // a byte order mark overrides any declared charset
+    if(n >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF)
+    {
+        charset_ = utf8;
+        p += 3;
+        n -= 3;
+    }
+    else if(n >= 2 && p[0] == 0xFF && p[1] == 0xFE)
+    {
+        charset_ = utf16le;
+        p += 2;
+        n -= 2;
+    }
+    else if(n >= 2 && p[0] == 0xFE && p[1] == 0xFF)
+    {
+        charset_ = utf16be;
+        p += 2;
+        n -= 2;
+    }
+    else
+    {
+        charset_ = declared_;
+        if(charset_ == unknown && handle_)
+        {
+            const char * type = handle_->info<const char *>(CURLINFO_CONTENT_TYPE);
+            if(type)
+                charset_ = charset_of(type);
+        }
+        if(charset_ == unknown)
+            charset_ = fallback_;
+    }
+
+    if(charset_ == other && n)
+        throw ERROR("Unsupported charset");
+    decode_(p, n);
+}
+
+void utf8_sink::decode_(const unsigned char * p, size_t n)
+{
+    switch(charset_)
+    {
+    case utf8:
+        if(!carry_.empty())
+        {
+            // complete the sequence cut off by the previous chunk; no
+            // sequence is longer than four bytes
+            size_t held = carry_.size();
+            std::string tmp(carry_);
+            tmp.append(reinterpret_cast<const char *>(p), std::min<size_t>(n, 4));
+            carry_.clear();
+
+            size_t used = utf8_(reinterpret_cast<const unsigned char *>(tmp.data()), tmp.size());
+            if(used < held)
+            {
+                carry_ = tmp.substr(used);
+                return;
+            }
+            p += used - held;
+            n -= used - held;
+        }
+        {
+            size_t used = utf8_(p, n);
+            carry_.assign(reinterpret_cast<const char *>(p + used), n - used);
+        }
+        break;
+
+    case latin1:
+    case windows_1252:
+        single_byte_(p, n);
+        break;
+
+    case utf16le:
+    case utf16be:
+        utf16_(p, n);
+        break;
+
+    default:
+        break;
+    }
+}
+
+size_t utf8_sink::utf8_(const unsigned char * p, size_t n)
+{
+    size_t i = 0, run = 0;
+    while((i = skip_ascii(p, i, n)) < n)
+    {
+        int len = sequence(p + i, n - i);
+        if(len > 0)
+        {
+            i += len;
+            continue;
+        }
+        if(len == 0)
+            break;
+
+        emit_(p + run, i - run);
+        replace_();
+        i += -len;
+        run = i;
+    }
+    emit_(p + run, i - run);
+    return i;
+}
+
+void utf8_sink::single_byte_(const unsigned char * p, size_t n)
+{
+    size_t i = 0, run = 0;
+    while((i = skip_ascii(p, i, n)) < n)
+    {
+        emit_(p + run, i - run);
+        unsigned int c = p[i];
+        if(charset_ == windows_1252 && c < 0xA0)
+            c = cp1252[c - 0x80];
+        encode_(c);
+        run = ++i;
+    }
+    emit_(p + run, i - run);
+}
+
+void utf8_sink::utf16_(const unsigned char * p, size_t n)
+{
+    bool big = charset_ == utf16be;
+
+    // a code unit split between chunks
+    if(!carry_.empty() && n)
+    {
+        unsigned int b = static_cast<unsigned char>(carry_[0]);
+        unit_(big ? (b << 8) | p[0] : b | (p[0] << 8));
+        carry_.clear();
+        ++p;
+        --n;
+    }
+
+    // four code units below 0x80 at a time
+    const uint64_t mask = big == host_big_endian ?
+        0xFF80FF80FF80FF80ULL : 0x80FF80FF80FF80FFULL;
+    const int low = big ? 1 : 0;
+
+    size_t i = 0;
+    while(i + 2 <= n)
+    {
+        if(high_ == 0)
+        {
+            for(; i + 8 <= n; i += 8)
+            {
+                uint64_t w;
+                memcpy(&w, p + i, sizeof(w));
+                if(w & mask)
+                    break;
+                char ascii[4] = {
+                    static_cast<char>(p[i + low]), static_cast<char>(p[i + 2 + low]),
+                    static_cast<char>(p[i + 4 + low]), static_cast<char>(p[i + 6 + low]),
+                };
+                out_.append(ascii, 4);
+            }
+            if(i + 2 > n)
+                break;
+        }
+
+        unit_(big ? (p[i] << 8) | p[i+1] : p[i] | (p[i+1] << 8));
+        i += 2;
+    }
+
+    if(i < n)
+        carry_.assign(1, static_cast<char>(p[i]));
+}
+
+void utf8_sink::unit_(unsigned int u)
+{
+    if(high_)
+    {
+        if(u >= 0xDC00 && u <= 0xDFFF)
+        {
+            encode_(0x10000 + ((high_ - 0xD800) << 10) + (u - 0xDC00));
+            high_ = 0;
+            return;
+        }
+        replace_();
+        high_ = 0;
+    }
+
+    if(u >= 0xD800 && u <= 0xDBFF)
+        high_ = u;
+    else if(u >= 0xDC00 && u <= 0xDFFF)
+        replace_();
+    else
+        encode_(u);
+}
+
+void utf8_sink::emit_(const unsigned char * p, size_t n)
+{
+    // long runs go to the next sink without being copied
+    if(n >= 4096)
+    {
+        flush_();
+        next_.write(reinterpret_cast<const char *>(p), n);
+    }
+    else
+        out_.append(reinterpret_cast<const char *>(p), n);
+}
+
+void utf8_sink::encode_(unsigned int cp)
+{
+    char buf[4];
+    size_t len;
+    if(cp < 0x80)
+    {
+        buf[0] = cp;
+        len = 1;
+    }
+    else if(cp < 0x800)
+    {
+        buf[0] = 0xC0 | (cp >> 6);
+        buf[1] = 0x80 | (cp & 0x3F);
+        len = 2;
+    }
+    else if(cp < 0x10000)
+    {
+        buf[0] = 0xE0 | (cp >> 12);
+        buf[1] = 0x80 | ((cp >> 6) & 0x3F);
+        buf[2] = 0x80 | (cp & 0x3F);
+        len = 3;
+    }
+    else
+    {
+        buf[0] = 0xF0 | (cp >> 18);
+        buf[1] = 0x80 | ((cp >> 12) & 0x3F);
+        buf[2] = 0x80 | ((cp >> 6) & 0x3F);
+        buf[3] = 0x80 | (cp & 0x3F);
+        len = 4;
+    }
+    out_.append(buf, len);
+}
+
+void utf8_sink::replace_()
+{
+    encode_(0xFFFD);
+    ++errors_;
+}
+
+void utf8_sink::flush_()
+{
+    if(out_.empty())
+        return;
+    next_.write(out_.data(), out_.size());
+    out_.clear();
+}
+
+}
+
+#undef ERROR
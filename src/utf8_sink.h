@@ -0,0 +1,103 @@
+/*
+ * utf8_sink.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_UTF8_SINK_H
+#define CURLPP_UTF8_SINK_H
+
+#include "curl++.h"
+#include <string>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Sink converting a text body to UTF-8 on the fly and passing it to `next`.
+//
+// The charset is taken from a byte order mark, else from the one given to
+// the constructor, else from the Content-Type of an attached handle, else
+// `fallback`. Like browsers, "iso-8859-1" and "us-ascii" labels are decoded
+// as Windows-1252; `latin1` decodes as strict ISO-8859-1. UTF-8 bodies are
+// only validated and passed through without copying. Invalid or truncated
+// sequences become U+FFFD, so `next` always receives valid UTF-8.
+//
+// ASCII runs are skipped eight bytes at a time in every charset.
+class utf8_sink
+    : public sink
+{
+public:
+    enum charset
+    {
+        unknown,        // no charset given
+        utf8,
+        latin1,
+        windows_1252,
+        utf16le,
+        utf16be,
+        other,          // a charset this sink does not decode
+    };
+
+    explicit utf8_sink(sink& next, charset cs = unknown, charset fallback = utf8);
+
+    // look at the Content-Type of `handle` when the body starts
+    void attach(easy& handle);
+
+    // throws if the charset turns out to be `other`
+    virtual void write(const char * data, size_t size);
+    virtual void finish();
+
+    // charset in use once the first bytes were written
+    inline charset detected() const
+    { return charset_; }
+
+    // number of invalid sequences replaced by U+FFFD
+    inline size_t errors() const
+    { return errors_; }
+
+    // charset named by the "charset" parameter of a Content-Type value
+    static charset charset_of(const std::string& content_type);
+
+private:
+    sink& next_;
+    charset declared_;
+    charset fallback_;
+    charset charset_;
+    easy * handle_;
+    bool started_;
+    std::string head_;      // first bytes, until a BOM can be ruled out
+    std::string carry_;     // incomplete sequence at the end of a chunk
+    unsigned int high_;     // pending UTF-16 high surrogate
+    std::string out_;
+    size_t errors_;
+
+    void start_();
+    void decode_(const unsigned char * p, size_t n);
+    size_t utf8_(const unsigned char * p, size_t n);
+    void single_byte_(const unsigned char * p, size_t n);
+    void utf16_(const unsigned char * p, size_t n);
+    void unit_(unsigned int u);
+    void emit_(const unsigned char * p, size_t n);
+    void encode_(unsigned int cp);
+    void replace_();
+    void flush_();
+};
+
+}
+
+#endif /* CURLPP_UTF8_SINK_H */
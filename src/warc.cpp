@@ -0,0 +1,560 @@
+/*
+ * warc.cpp
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "warc.h"
+#include <cctype>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <strings.h>
+#include <openssl/rand.h>
+#include <zlib.h>
+
+#define ERROR(x) \
+    error(x, __FILE__, __LINE__)
+
+namespace curl
+{
+
+namespace
+{
+    // where warc_sink::unchunk_ is in the chunked framing
+    enum
+    {
+        chunk_size,             // size line, with extensions
+        chunk_extension,
+        chunk_data,
+        chunk_end,              // CRLF after the data
+        chunk_trailer           // after the last chunk
+    };
+
+    // gzip member appended to `out` piece by piece
+    class gzip_member
+    {
+    public:
+        gzip_member(int level, std::string& out)
+            : out_(out)
+        {
+            memset(&zs_, 0, sizeof(zs_));
+            // windowBits + 16 selects the gzip wrapper
+            if(deflateInit2(&zs_, level, Z_DEFLATED, 15 + 16, 8,
+                            Z_DEFAULT_STRATEGY) != Z_OK)
+                throw ERROR("Failed to initialize deflate stream");
+        }
+
+        ~gzip_member()
+        {
+            deflateEnd(&zs_);
+        }
+
+        void add(const char * data, size_t size)
+        {
+            zs_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+            zs_.avail_in = size;
+            run_(Z_NO_FLUSH);
+        }
+
+        void add(const std::string& data)
+        {
+            add(data.data(), data.size());
+        }
+
+        void finish()
+        {
+            zs_.next_in = nullptr;
+            zs_.avail_in = 0;
+            run_(Z_FINISH);
+        }
+
+    private:
+        z_stream zs_;
+        std::string& out_;
+
+        void run_(int flush)
+        {
+            for(;;)
+            {
+                size_t pos = out_.size();
+                size_t room = deflateBound(&zs_, zs_.avail_in) + 64;
+                out_.resize(pos + room);
+                zs_.next_out = reinterpret_cast<Bytef *>(&out_[pos]);
+                zs_.avail_out = room;
+
+                int rc = deflate(&zs_, flush);
+                out_.resize(out_.size() - zs_.avail_out);
+                if(rc == Z_STREAM_END || (flush == Z_NO_FLUSH && zs_.avail_in == 0))
+                    return;
+                if(rc != Z_OK && rc != Z_BUF_ERROR)
+                    throw ERROR("Failed to deflate WARC record");
+            }
+        }
+    };
+
+    bool has_field(const warc_writer::fields& header, const char * name)
+    {
+        for(auto&& f : header)
+            if(strcasecmp(f.first.c_str(), name) == 0)
+                return true;
+        return false;
+    }
+
+    // "WARC/1.1" line and header fields, up to and including the empty line
+    std::string header_text(const warc_writer::fields& header, uint64_t size)
+    {
+        std::string text("WARC/1.1\r\n");
+        for(auto&& f : header)
+            text += f.first + ": " + f.second + "\r\n";
+
+        if(!has_field(header, "WARC-Record-ID"))
+            text += "WARC-Record-ID: " + warc_writer::record_id() + "\r\n";
+        if(!has_field(header, "WARC-Date"))
+        {
+            using namespace std::chrono;
+            int64_t now = duration_cast<microseconds>(
+                system_clock::now().time_since_epoch()).count();
+            text += "WARC-Date: " + warc_writer::date(now) + "\r\n";
+        }
+        if(!has_field(header, "Content-Length"))
+            text += "Content-Length: " + std::to_string(size) + "\r\n";
+        return text += "\r\n";
+    }
+
+    void write_all(int fd, const char * data, size_t size)
+    {
+        while(size)
+        {
+            ssize_t n = ::write(fd, data, size);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                throw ERROR("Failed to write WARC file");
+            data += n;
+            size -= n;
+        }
+    }
+
+    std::string millis(curl_off_t usecs)
+    {
+        return std::to_string(usecs / 1000);
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+warc_writer::warc_writer(const std::string& prefix)
+    : warc_writer(prefix, options())
+{}
+
+warc_writer::warc_writer(const std::string& prefix, options opts)
+    : prefix_(prefix)
+    , opts_(std::move(opts))
+    , fd_(-1)
+    , serial_(0)
+    , size_(0)
+    , empty_(true)
+{}
+
+warc_writer::~warc_writer()
+{
+    if(fd_ < 0)
+        return;
+    try
+    {
+        flush_();
+    }
+    catch(...)
+    {}
+    close(fd_);
+}
+
+std::string warc_writer::record(const fields& header, const char * block, size_t size) const
+{
+    std::string out;
+    gzip_member m(opts_.level, out);
+    m.add(header_text(header, size));
+    m.add(block, size);
+    m.add("\r\n\r\n", 4);
+    m.finish();
+    return out;
+}
+
+void warc_writer::append(const std::vector<std::string>& members)
+{
+    uint64_t total = 0;
+    for(auto&& m : members)
+        total += m.size();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(fd_ >= 0 && !empty_ && size_ + total > opts_.max_file_size)
+    {
+        flush_();
+        close(fd_);
+        fd_ = -1;
+        ++serial_;
+    }
+    if(fd_ < 0)
+        open_();
+
+    for(auto&& m : members)
+        buffer_ += m;
+    size_ += total;
+    empty_ = false;
+
+    if(buffer_.size() >= opts_.buffer_size)
+        flush_();
+}
+
+void warc_writer::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(fd_ >= 0)
+        flush_();
+}
+
+std::string warc_writer::current() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return path_;
+}
+
+std::string warc_writer::record_id()
+{
+    unsigned char b[16];
+    if(RAND_bytes(b, sizeof(b)) != 1)
+        throw ERROR("Failed to generate WARC record ID");
+
+    // random (version 4) UUID
+    b[6] = (b[6] & 0x0f) | 0x40;
+    b[8] = (b[8] & 0x3f) | 0x80;
+
+    char buf[64];
+    snprintf(buf, sizeof(buf),
+        "<urn:uuid:%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-"
+        "%02x%02x%02x%02x%02x%02x>",
+        b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7],
+        b[8], b[9], b[10], b[11], b[12], b[13], b[14], b[15]);
+    return buf;
+}
+
+std::string warc_writer::date(int64_t usecs_since_epoch)
+{
+    time_t secs = usecs_since_epoch / 1000000;
+    struct tm tm;
+    gmtime_r(&secs, &tm);
+
+    char buf[64];
+    size_t len = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(buf + len, sizeof(buf) - len, ".%06dZ",
+             static_cast<int>(usecs_since_epoch % 1000000));
+    return buf;
+}
+
+void warc_writer::open_()
+{
+    // never touch existing files; skip to the next free serial number
+    for(;;)
+    {
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), "-%05u.warc.gz", serial_);
+        path_ = prefix_ + suffix;
+
+        fd_ = open(path_.c_str(),
+                   O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+        if(fd_ >= 0)
+            break;
+        if(errno != EEXIST)
+            throw ERROR("Failed to open WARC file");
+        ++serial_;
+    }
+
+    std::string name = path_.substr(path_.rfind('/') + 1);
+    std::string info =
+        "software: " + opts_.software + "\r\n"
+        "format: WARC File Format 1.1\r\n"
+        "conformsTo: http://iipc.github.io/warc-specifications/"
+        "specifications/warc-format/warc-1.1/\r\n" + opts_.info;
+
+    buffer_ = record({
+        {"WARC-Type", "warcinfo"},
+        {"WARC-Filename", name},
+        {"Content-Type", "application/warc-fields"},
+    }, info.data(), info.size());
+    size_ = buffer_.size();
+    empty_ = true;
+}
+
+void warc_writer::flush_()
+{
+    if(buffer_.empty())
+        return;
+    write_all(fd_, buffer_.data(), buffer_.size());
+    buffer_.clear();
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+warc_sink::warc_sink(warc_writer& out, size_t memory_limit)
+    : out_(out)
+    , memory_limit_(memory_limit)
+    , handle_(nullptr)
+    , started_(false)
+    , spill_(nullptr)
+    , size_(0)
+    , block_(digest::sha1)
+    , payload_(digest::sha1)
+    , chunked_(false)
+    , chunk_state_(chunk_size)
+    , chunk_left_(0)
+{}
+
+warc_sink::~warc_sink()
+{
+    if(spill_)
+        fclose(spill_);
+}
+
+void warc_sink::attach(easy& handle)
+{
+    handle_ = &handle;
+    response_.attach(handle);
+    request_.clear();
+    head_.clear();
+    body_.clear();
+    if(spill_)
+    {
+        fclose(spill_);
+        spill_ = nullptr;
+    }
+    started_ = false;
+    size_ = 0;
+    block_.finish();
+    payload_.finish();
+
+    handle.set(CURLOPT_DEBUGDATA, static_cast<void *>(this));
+    handle.set(CURLOPT_DEBUGFUNCTION, warc_sink::debug_);
+    handle.set(CURLOPT_VERBOSE, 1L);
+    handle.set(CURLOPT_HTTP_CONTENT_DECODING, 0L);
+    handle.set(CURLOPT_HTTP_TRANSFER_DECODING, 0L);
+}
+
+void warc_sink::write(const char * data, size_t size)
+{
+    if(!started_)
+        start_();
+
+    block_.update(data, size);
+    if(chunked_)
+        unchunk_(data, size);
+    else
+        payload_.update(data, size);
+    size_ += size;
+
+    if(!spill_)
+    {
+        body_.append(data, size);
+        if(body_.size() <= memory_limit_)
+            return;
+
+        if((spill_ = tmpfile()) == nullptr)
+            throw ERROR("Failed to create WARC spill file");
+        data = body_.data();
+        size = body_.size();
+    }
+
+    if(fwrite(data, 1, size, spill_) != size)
+        throw ERROR("Failed to write WARC spill file");
+    std::string().swap(body_);
+}
+
+void warc_sink::finish()
+{
+    if(handle_ == nullptr)
+        throw ERROR("warc_sink is not attached to a handle");
+    if(!started_)
+        start_();
+
+    const char * url = handle_->info<const char *>(CURLINFO_EFFECTIVE_URL);
+    const char * ip = handle_->info<const char *>(CURLINFO_PRIMARY_IP);
+    curl_off_t total = handle_->info<curl_off_t>(CURLINFO_TOTAL_TIME_T);
+
+    // WARC-Date is the start of the capture
+    using namespace std::chrono;
+    int64_t now = duration_cast<microseconds>(
+        system_clock::now().time_since_epoch()).count();
+    std::string date = warc_writer::date(now - total);
+    std::string target = url ? url : "";
+    id_ = warc_writer::record_id();
+
+    // without protocol headers, e.g. for file:// or ftp://, the body is
+    // archived as a resource record
+    bool http = !head_.empty();
+    warc_writer::fields header{
+        {"WARC-Type", http ? "response" : "resource"},
+        {"WARC-Record-ID", id_},
+        {"WARC-Date", date},
+        {"WARC-Target-URI", target},
+    };
+    if(ip && *ip)
+        header.emplace_back("WARC-IP-Address", ip);
+    header.emplace_back("WARC-Block-Digest", "sha1:" + digest::base32(block_.finish()));
+    if(http)
+    {
+        header.emplace_back("WARC-Payload-Digest", "sha1:" + digest::base32(payload_.finish()));
+        header.emplace_back("Content-Type", "application/http;msgtype=response");
+    }
+    else
+        payload_.finish();
+
+    std::vector<std::string> members;
+    if(!request_.empty())
+    {
+        members.push_back(out_.record({
+            {"WARC-Type", "request"},
+            {"WARC-Date", date},
+            {"WARC-Target-URI", target},
+            {"WARC-Concurrent-To", id_},
+            {"Content-Type", "application/http;msgtype=request"},
+        }, request_.data(), request_.size()));
+    }
+
+    // the response block is streamed into its member, body from the spill
+    // file if it got too large for memory
+    members.emplace_back();
+    gzip_member m(out_.opts_.level, members.back());
+    m.add(header_text(header, head_.size() + size_));
+    m.add(head_);
+    if(spill_)
+    {
+        rewind(spill_);
+        char buf[64 * 1024];
+        size_t n;
+        while((n = fread(buf, 1, sizeof(buf), spill_)) > 0)
+            m.add(buf, n);
+        if(ferror(spill_))
+            throw ERROR("Failed to read WARC spill file");
+        fclose(spill_);
+        spill_ = nullptr;
+    }
+    else
+        m.add(body_);
+    m.add("\r\n\r\n", 4);
+    m.finish();
+
+    std::string timing =
+        "fetchTimeMs: " + millis(total) + "\r\n"
+        "nameLookupTimeMs: " + millis(handle_->info<curl_off_t>(CURLINFO_NAMELOOKUP_TIME_T)) + "\r\n"
+        "connectTimeMs: " + millis(handle_->info<curl_off_t>(CURLINFO_CONNECT_TIME_T)) + "\r\n"
+        "tlsHandshakeTimeMs: " + millis(handle_->info<curl_off_t>(CURLINFO_APPCONNECT_TIME_T)) + "\r\n"
+        "firstByteTimeMs: " + millis(handle_->info<curl_off_t>(CURLINFO_STARTTRANSFER_TIME_T)) + "\r\n";
+    members.push_back(out_.record({
+        {"WARC-Type", "metadata"},
+        {"WARC-Date", date},
+        {"WARC-Target-URI", target},
+        {"WARC-Refers-To", id_},
+        {"Content-Type", "application/warc-fields"},
+    }, timing.data(), timing.size()));
+
+    out_.append(members);
+
+    std::string().swap(body_);
+    head_.clear();
+    request_.clear();
+    started_ = false;
+    size_ = 0;
+}
+
+void warc_sink::start_()
+{
+    // trailers arriving after the body are not part of the archived headers
+    head_ = response_.raw();
+    block_.update(head_.data(), head_.size());
+    started_ = true;
+
+    // chunked is always the last transfer coding
+    std::string coding = response_.get("Transfer-Encoding");
+    chunked_ = coding.size() >= 7
+        && strcasecmp(coding.c_str() + coding.size() - 7, "chunked") == 0;
+    chunk_state_ = chunk_size;
+    chunk_left_ = 0;
+}
+
+void warc_sink::unchunk_(const char * data, size_t size)
+{
+    while(size)
+    {
+        char c = *data;
+        switch(chunk_state_)
+        {
+        case chunk_size:
+        case chunk_extension:
+            if(c == '\n')
+                chunk_state_ = chunk_left_ ? chunk_data : chunk_trailer;
+            else if(c == ';')
+                chunk_state_ = chunk_extension;
+            else if(chunk_state_ == chunk_size && isxdigit(static_cast<unsigned char>(c)))
+                chunk_left_ = chunk_left_ * 16 + (isdigit(static_cast<unsigned char>(c))
+                                                  ? c - '0' : (c | 0x20) - 'a' + 10);
+            break;
+
+        case chunk_data:
+        {
+            size_t n = chunk_left_ < size ? static_cast<size_t>(chunk_left_) : size;
+            payload_.update(data, n);
+            chunk_left_ -= n;
+            if(chunk_left_ == 0)
+                chunk_state_ = chunk_end;
+            data += n;
+            size -= n;
+            continue;
+        }
+
+        case chunk_end:
+            if(c == '\n')
+                chunk_state_ = chunk_size;
+            break;
+
+        default:
+            // trailers are not part of the payload
+            return;
+        }
+        ++data;
+        --size;
+    }
+}
+
+int warc_sink::debug_(CURL *, curl_infotype type, char * data, size_t size, void * arg)
+{
+    warc_sink * self = static_cast<warc_sink *>(arg);
+
+    // every request (e.g. after a redirect) starts with its headers
+    if(type == CURLINFO_HEADER_OUT)
+        self->request_.assign(data, size);
+    else if(type == CURLINFO_DATA_OUT)
+        self->request_.append(data, size);
+    return 0;
+}
+
+}
+
+#undef ERROR
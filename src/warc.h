@@ -0,0 +1,154 @@
+/*
+ * warc.h
+ *
+ * Copyright 2014 Mike Fährmann <mike_faehrmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CURLPP_WARC_H
+#define CURLPP_WARC_H
+
+#include "curl++.h"
+#include "digest.h"
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace curl
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Append-only WARC 1.1 file writer shared by any number of transfers.
+//
+// Every record is compressed into its own gzip member by the calling thread;
+// only appending the finished members to the output buffer is serialized.
+// Output goes to `<prefix>-00000.warc.gz`, `<prefix>-00001.warc.gz`, ...,
+// moving on to the next file once `max_file_size` is reached. Each file
+// starts with a warcinfo record.
+class warc_writer
+{
+public:
+    struct options
+    {
+        uint64_t max_file_size = uint64_t(1) << 30;
+        size_t buffer_size = 1024 * 1024;
+        int level = 6;
+        std::string software = "curl++";
+        std::string info;           // extra warcinfo fields, "name: value\r\n"
+    };
+
+    // a record's named header fields; WARC-Record-ID, WARC-Date and
+    // Content-Length are added by the writer if missing
+    typedef std::vector<std::pair<std::string, std::string>> fields;
+
+    explicit warc_writer(const std::string& prefix);
+    warc_writer(const std::string& prefix, options opts);
+    ~warc_writer();
+
+    warc_writer(const warc_writer& other) = delete;
+    warc_writer& operator = (const warc_writer& other) = delete;
+
+    // compress a single record into a gzip member
+    std::string record(const fields& header, const char * block, size_t size) const;
+
+    // append members as one unit, never split across files
+    void append(const std::vector<std::string>& members);
+
+    // write buffered members to disk
+    void flush();
+
+    // path of the file currently written to
+    std::string current() const;
+
+    static std::string record_id();
+    static std::string date(int64_t usecs_since_epoch);
+
+private:
+    friend class warc_sink;
+
+    std::string prefix_;
+    options opts_;
+    mutable std::mutex mutex_;
+    int fd_;
+    unsigned serial_;
+    uint64_t size_;
+    bool empty_;                // only the warcinfo record so far
+    std::string path_;
+    std::string buffer_;
+
+    void open_();
+    void flush_();
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Sink archiving one transfer as WARC request, response and metadata records.
+//
+// `attach` installs a header callback for the response headers and a debug
+// callback for the request as sent, and turns off content and transfer
+// decoding so the archived body matches the archived headers; the payload
+// digest is taken over the body without its chunked framing. Bodies larger than
+// `memory_limit` are spilled to a temporary file until finish() writes the
+// records. With CURLOPT_FOLLOWLOCATION only the final exchange is archived.
+class warc_sink
+    : public sink
+{
+public:
+    explicit warc_sink(warc_writer& out, size_t memory_limit = 4 * 1024 * 1024);
+    ~warc_sink();
+
+    warc_sink(const warc_sink& other) = delete;
+    warc_sink& operator = (const warc_sink& other) = delete;
+
+    void attach(easy& handle);
+
+    virtual void write(const char * data, size_t size);
+    virtual void finish();
+
+    // WARC-Record-ID of the last response record
+    inline const std::string& id() const
+    { return id_; }
+
+private:
+    warc_writer& out_;
+    size_t memory_limit_;
+    easy * handle_;
+    headers response_;
+    std::string request_;
+    std::string head_;          // response headers as of the first body byte
+    bool started_;
+    std::string body_;
+    FILE * spill_;
+    uint64_t size_;
+    digest block_;
+    digest payload_;
+    bool chunked_;
+    int chunk_state_;
+    uint64_t chunk_left_;
+    std::string id_;
+
+    void start_();
+    void unchunk_(const char * data, size_t size);
+
+    static int debug_(CURL *, curl_infotype, char *, size_t, void *);
+};
+
+}
+
+#endif /* CURLPP_WARC_H */